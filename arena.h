@@ -39,22 +39,70 @@
 #define ARENA_BACKEND_LINUX_MMAP 1
 #define ARENA_BACKEND_WIN32_VIRTUALALLOC 2
 #define ARENA_BACKEND_WASM_HEAPBASE 3
+#define ARENA_BACKEND_LINUX_MMAP_RESERVE 4
 
 #ifndef ARENA_BACKEND
 #define ARENA_BACKEND ARENA_BACKEND_LIBC_MALLOC
 #endif // ARENA_BACKEND
 
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
 typedef struct Region Region;
 
 struct Region {
     Region *next;
     size_t count;
     size_t capacity;
+    size_t flags;
     uintptr_t data[];
 };
 
+// The region lives in memory that belongs to the caller (see arena_init_buffer()), so the
+// arena never gives it back to the backend
+#define ARENA_REGION_BORROWED 1
+// The region has free address space set aside right after it, so growing it in place is cheap
+// and arena_alloc() tries that before starting a new region. Backends set this on the regions
+// their grow_region() can usually grow, arena_realloc() tries to grow any region regardless
+#define ARENA_REGION_GROWABLE 2
+
+#ifdef ARENA_RUNTIME_BACKENDS
+// With ARENA_RUNTIME_BACKENDS defined each arena may get its regions from its own backend
+// instead of the one selected by ARENA_BACKEND. Custom backends can embed Arena_Backend into
+// a bigger struct to carry their state around.
+typedef struct Arena_Backend Arena_Backend;
+
+struct Arena_Backend {
+    Region *(*new_region)(Arena_Backend *b, size_t capacity);
+    void (*free_region)(Arena_Backend *b, Region *r);
+    // Optional. Same contract as grow_region()
+    int (*grow_region)(Arena_Backend *b, Region *r, size_t capacity);
+    // Optional. Same contract as decommit_region()
+    void (*decommit_region)(Arena_Backend *b, Region *r);
+};
+#endif // ARENA_RUNTIME_BACKENDS
+
+#ifdef ARENA_PROVISION
+typedef struct Arena_Provision Arena_Provision;
+#endif // ARENA_PROVISION
+
 typedef struct {
     Region *begin, *end;
+    // Never get memory from the backend, arena_alloc() returns NULL once the arena is full.
+    // Mostly useful together with arena_init_buffer().
+    int fixed;
+#ifdef ARENA_RUNTIME_BACKENDS
+    // NULL means the backend selected by ARENA_BACKEND. Only change it while the arena is empty.
+    Arena_Backend *backend;
+#endif // ARENA_RUNTIME_BACKENDS
+#ifdef ARENA_NUMA
+    int numa_policy;
+    int numa_node;
+#endif // ARENA_NUMA
+#ifdef ARENA_PROVISION
+    Arena_Provision *provision; // see arena_provision_start()
+#endif // ARENA_PROVISION
 } Arena;
 
 typedef struct  {
@@ -62,14 +110,77 @@ typedef struct  {
     size_t count;
 } Arena_Mark;
 
+#ifdef ARENA_STATS
+// Process-wide counters collected by the backends when ARENA_STATS is defined.
+// They are not synchronized, so with several threads allocating regions they are approximate.
+typedef struct {
+    size_t regions_allocated;
+    size_t regions_freed;
+    size_t hugetlb_regions;    // regions that actually got MAP_HUGETLB pages
+    size_t hugetlb_fallbacks;  // regions that asked for MAP_HUGETLB but fell back to regular pages
+    size_t thp_advised_regions; // regions advised with MADV_HUGEPAGE, see arena_stats_thp_bytes() for how much the kernel backed with huge pages
+    size_t prefault_minor_faults; // page faults taken by arena_prefault(), according to getrusage()
+    size_t prefault_major_faults;
+    size_t region_cache_hits;     // new_region() calls served by ARENA_REGION_CACHE
+    size_t region_cache_misses;   // new_region() calls that had to go to the backend
+    size_t provision_hits;        // regions an arena took from its ARENA_PROVISION pool
+    size_t provision_misses;      // regions an arena had to get itself because its pool was empty
+    size_t regions_skipped;       // regions arena_alloc() moved past because the allocation didn't fit into their rest
+    size_t oversized_allocs;      // allocations bigger than ARENA_REGION_DEFAULT_CAPACITY that got a region of their own size
+} Arena_Stats;
+
+extern Arena_Stats arena_stats;
+#if defined(__linux__) && !defined(ARENA_NOSTDIO)
+// How many bytes of the mappings that the regions of `a` lie in are actually backed by
+// Transparent Huge Pages right now, according to AnonHugePages in /proc/self/smaps. The kernel
+// merges neighbouring mappings, so this may include memory next to the regions. Returns 0 if
+// smaps can't be read.
+size_t arena_stats_thp_bytes(Arena *a);
+#endif // __linux__ && !ARENA_NOSTDIO
+#endif // ARENA_STATS
+
 #ifndef ARENA_REGION_DEFAULT_CAPACITY
 #define ARENA_REGION_DEFAULT_CAPACITY (8*1024)
 #endif // ARENA_REGION_DEFAULT_CAPACITY
 
 Region *new_region(size_t capacity);
 void free_region(Region *r);
+// Try to extend the region in place so it can hold at least `capacity` words. Returns 0 if the
+// backend can't do that, in which case the arena chains a new region instead. arena_alloc() only
+// asks for regions flagged ARENA_REGION_GROWABLE, arena_realloc() asks for any region.
+int grow_region(Region *r, size_t capacity);
+// Give the memory past r->count back to the OS, keeping the region itself usable. Backends that
+// can't do that do nothing. arena_trim() calls it on the last region it keeps.
+void decommit_region(Region *r);
+
+#ifdef ARENA_RUNTIME_BACKENDS
+// The backend selected by ARENA_BACKEND (behind ARENA_REGION_CACHE if it is enabled)
+extern Arena_Backend arena_backend_default;
+#ifndef __wasm__
+extern Arena_Backend arena_backend_libc_malloc;
+#endif // __wasm__
+#ifdef __linux__
+extern Arena_Backend arena_backend_linux_mmap;
+extern Arena_Backend arena_backend_linux_mmap_hugetlb;
+extern Arena_Backend arena_backend_linux_mmap_thp;
+extern Arena_Backend arena_backend_linux_mmap_reserve;
+#endif // __linux__
+#ifdef _WIN32
+extern Arena_Backend arena_backend_win32_virtualalloc;
+#endif // _WIN32
+#endif // ARENA_RUNTIME_BACKENDS
 
 void *arena_alloc(Arena *a, size_t size_bytes);
+// Grows the last allocation of the arena in place when there is room for it in its region or
+// the backend can grow the region (see grow_region()), otherwise copies it into a new allocation.
+// The old block stays readable after a copy, but not after a move: with ARENA_MREMAP_MAYMOVE the
+// old mapping is gone, so never read through oldptr once arena_realloc() has returned.
+// Growing a region in place needs free address space right after it. ARENA_BACKEND_LINUX_MMAP_RESERVE
+// sets that aside up front, but ARENA_BACKEND_LINUX_MMAP rarely finds it, since the kernel places
+// new mappings top-down, right below the previous ones. With ARENA_MREMAP_MAYMOVE defined and
+// ARENA_BACKEND_LINUX_MMAP a region that holds nothing but the reallocated block can be moved by
+// the kernel with mremap() instead, so huge dynamic arrays never get copied. Arena_Marks of such
+// a region become invalid when it moves.
 void *arena_realloc(Arena *a, void *oldptr, size_t oldsz, size_t newsz);
 char *arena_strdup(Arena *a, const char *cstr);
 void *arena_memdup(Arena *a, void *data, size_t size);
@@ -84,6 +195,339 @@ void arena_reset(Arena *a);
 void arena_rewind(Arena *a, Arena_Mark m);
 void arena_free(Arena *a);
 void arena_trim(Arena *a);
+// Fault in the memory for the next `size_bytes` that the arena is going to hand out, adding
+// regions if needed, so a latency critical section that follows doesn't take page faults.
+void arena_prefault(Arena *a, size_t size_bytes);
+// Start an empty arena over a buffer supplied by the caller, e.g. an array on the stack, so
+// small workloads never touch the heap. Once the buffer is full the arena chains regions
+// from the backend as usual, unless a->fixed is set. The buffer is never freed by the arena.
+void arena_init_buffer(Arena *a, void *buf, size_t size_bytes);
+// Move everything allocated in `src` over to `dst` in O(1) by linking the regions of `src` right
+// after the current region of `dst`, which then continues allocating in the last one of them.
+// `src` is left empty, only keeping its spare regions (those past its current one). Marks taken
+// on `dst` before still work, rewinding to them drops what was spliced in. Both arenas must get
+// their regions from the same backend, and buffers of arena_init_buffer() spliced along must
+// outlive `dst`.
+void arena_splice(Arena *dst, Arena *src);
+
+#ifdef ARENA_SCRATCH
+// With ARENA_SCRATCH defined every thread has ARENA_SCRATCH_COUNT scratch arenas for temporary
+// allocations. They start empty and keep their regions between uses, so after warming up they
+// don't call the backend at all. With POSIX threads the regions are given back when the thread
+// exits, elsewhere threads have to call arena_scratch_free() themselves.
+#ifndef ARENA_SCRATCH_COUNT
+#define ARENA_SCRATCH_COUNT 2
+#endif // ARENA_SCRATCH_COUNT
+
+typedef struct {
+    Arena *arena;
+    Arena_Mark mark;
+} Arena_Scratch;
+
+// Get a scratch arena of the calling thread that is none of the `conflicts` (typically the arena
+// the caller allocates its result in, which may itself be a scratch arena further up the stack).
+// Everything allocated in it until the matching arena_scratch_end() is thrown away there.
+Arena_Scratch arena_scratch_begin(Arena **conflicts, size_t conflicts_count);
+void arena_scratch_end(Arena_Scratch scratch);
+// Give the regions of the scratch arenas of the calling thread back to the backend
+void arena_scratch_free(void);
+#endif // ARENA_SCRATCH
+
+#ifdef ARENA_REGION_CACHE
+// With ARENA_REGION_CACHE defined free_region() doesn't give regions back to the backend right
+// away but keeps them in a process-wide cache, and new_region() takes them from there. Each thread
+// has a few slots of its own in front of the shared cache, which are used without locking.
+// Requires POSIX threads. Give the shared cache and the slots of the calling thread back to the
+// backend (the slots of other threads go when they exit or their regions get too old):
+void arena_region_cache_flush(void);
+#endif // ARENA_REGION_CACHE
+
+#if ARENA_BACKEND == ARENA_BACKEND_WASM_HEAPBASE
+// Throw away every region of ARENA_BACKEND_WASM_HEAPBASE at once by moving its bump allocator back
+// to __heap_base. All the arenas have to be forgotten (or zeroed) before using them again.
+void arena_wasm_heapbase_reset(void);
+#endif // ARENA_BACKEND_WASM_HEAPBASE
+
+#ifdef ARENA_NUMA
+// NUMA placement of the regions of an arena (Linux only). The policy is applied with mbind() to
+// every region the arena gets from now on. When the kernel has no NUMA support, or there is only
+// one node, it does nothing.
+#define ARENA_NUMA_DEFAULT 0    // leave it to the kernel, which places pages on the node that touches them first
+#define ARENA_NUMA_PREFERRED 1  // prefer `node`, fall back to other nodes when it runs out of memory
+#define ARENA_NUMA_INTERLEAVE 2 // interleave pages across all the nodes the process is allowed to use
+#define ARENA_NUMA_LOCAL 3      // prefer the node of the thread calling arena_set_numa_policy(), `node` is ignored
+void arena_set_numa_policy(Arena *a, int policy, int node);
+// The node the memory of the region lives on, or -1 if it can't be determined
+int arena_region_numa_node(Region *r);
+#endif // ARENA_NUMA
+
+#if defined(ARENA_PERCPU) || defined(ARENA_EPOCH)
+// Alignment of the data that different threads write, so it starts on a cache line of its own.
+// Instances on the heap have to be allocated with that alignment too, e.g. with aligned_alloc().
+#ifndef ARENA_CACHE_LINE_SIZE
+#define ARENA_CACHE_LINE_SIZE 64
+#endif // ARENA_CACHE_LINE_SIZE
+
+#if defined(__cplusplus)
+#define ARENA_CACHE_ALIGNED alignas(ARENA_CACHE_LINE_SIZE)
+#elif defined(_MSC_VER)
+#define ARENA_CACHE_ALIGNED __declspec(align(ARENA_CACHE_LINE_SIZE))
+#elif defined(__GNUC__)
+#define ARENA_CACHE_ALIGNED __attribute__((aligned(ARENA_CACHE_LINE_SIZE)))
+#else
+#define ARENA_CACHE_ALIGNED _Alignas(ARENA_CACHE_LINE_SIZE)
+#endif
+#endif
+
+#if defined(ARENA_PERCPU) && !defined(ARENA_SHARED)
+#define ARENA_SHARED // per-CPU arenas are made of shared ones
+#endif
+
+#ifdef ARENA_SHARED
+// With ARENA_SHARED defined there is also an arena that many threads can allocate from at the same
+// time (requires POSIX threads and GCC or Clang atomics). Allocations bump the count of the current
+// region with a compare-and-swap, only getting a new region takes the lock.
+#include <pthread.h>
+
+typedef struct {
+    Arena arena;
+    pthread_mutex_t lock; // only protects getting new regions
+} Arena_Shared;
+
+#define ARENA_SHARED_INIT {{0}, PTHREAD_MUTEX_INITIALIZER}
+
+// Thread safe
+void *arena_shared_alloc(Arena_Shared *s, size_t size_bytes);
+// Not thread safe, nobody else may be allocating from the arena while these run
+void arena_shared_reset(Arena_Shared *s);
+void arena_shared_free(Arena_Shared *s);
+#endif // ARENA_SHARED
+
+#ifdef ARENA_PERCPU
+// With ARENA_PERCPU defined there is also a concurrent arena striped by CPU: every stripe is an
+// Arena_Shared with its own regions and a thread allocates from the stripe of the CPU it runs on
+// (sched_getcpu() on Linux, otherwise a stripe picked per thread). So the compare-and-swap almost
+// never contends and the region being bumped stays in the cache of that core.
+#ifndef ARENA_PERCPU_STRIPES
+#define ARENA_PERCPU_STRIPES 64 // CPUs past that share stripes
+#endif // ARENA_PERCPU_STRIPES
+
+typedef struct {
+    // Aligned and padded, so the stripes of different CPUs don't share cache lines
+    ARENA_CACHE_ALIGNED union {
+        Arena_Shared shared;
+        char padding[2*ARENA_CACHE_LINE_SIZE];
+    } stripes[ARENA_PERCPU_STRIPES];
+} Arena_PerCPU;
+
+void arena_percpu_init(Arena_PerCPU *p);
+// Thread safe
+void *arena_percpu_alloc(Arena_PerCPU *p, size_t size_bytes);
+// Not thread safe, reset or free all the stripes at once
+void arena_percpu_reset(Arena_PerCPU *p);
+void arena_percpu_free(Arena_PerCPU *p);
+#endif // ARENA_PERCPU
+
+#ifdef ARENA_PROVISION
+// With ARENA_PROVISION defined a helper thread (POSIX threads) can keep a small pool of spare,
+// already prefaulted regions for an arena, so when the arena runs out of room it takes a region
+// from the pool in O(1) instead of calling the backend and faulting the pages in on the hot path.
+// The helper refills the pool in the background.
+#ifndef ARENA_PROVISION_POOL_SIZE
+#define ARENA_PROVISION_POOL_SIZE 4
+#endif // ARENA_PROVISION_POOL_SIZE
+
+struct Arena_Provision {
+    // Single producer (the helper) single consumer (the thread using the arena) ring
+    Region *pool[ARENA_PROVISION_POOL_SIZE];
+    size_t head;     // next region to take, only written by the arena
+    size_t tail;     // next slot to fill, only written by the helper
+    size_t capacity; // of the regions in the pool, allocations that don't fit still go to the backend
+    Arena *arena;
+    Arena_Provision *next;
+};
+
+// Register the arena with the helper thread, which is started on first use. `p` has to live until
+// arena_provision_stop(). Regions are created with `capacity` words, at least ARENA_REGION_DEFAULT_CAPACITY.
+// The helper creates them on behalf of the arena, so its backend and NUMA policy must not change meanwhile.
+void arena_provision_start(Arena *a, Arena_Provision *p, size_t capacity);
+// Unregister the arena and give the regions left in its pool back to the backend
+void arena_provision_stop(Arena *a);
+// Stop the helper thread and wait for it to exit, e.g. before unloading the code or checking for
+// leaks. Every arena has to be stopped first. arena_provision_start() starts a new helper.
+void arena_provision_shutdown(void);
+#endif // ARENA_PROVISION
+
+#ifdef ARENA_FREE_ASYNC
+// With ARENA_FREE_ASYNC defined arenas can also be freed by a reclaimer thread (POSIX threads),
+// so the thread that is done with a big arena doesn't spend its time in free()/munmap().
+// Like arena_free() but only detaches the regions in O(1) and leaves the rest to the reclaimer.
+// Buffers of arena_init_buffer() spliced into the middle of the arena with arena_splice() must
+// stay alive until arena_free_async_flush().
+void arena_free_async(Arena *a);
+// Wait until everything passed to arena_free_async() so far is given back to the backend
+void arena_free_async_flush(void);
+#endif // ARENA_FREE_ASYNC
+
+#ifdef ARENA_EPOCH
+// With ARENA_EPOCH defined there is a ring of arenas for one writer that rebuilds some data over
+// and over while many readers keep using the previous versions (requires GCC or Clang atomics).
+// Every publish starts a new epoch living in the next arena of the ring, and an arena is only
+// reset for reuse once all the readers that entered its epoch have left. RCU at arena granularity.
+#ifndef ARENA_EPOCH_SLOTS
+#define ARENA_EPOCH_SLOTS 3 // the current version, one still being read and one being built
+#endif // ARENA_EPOCH_SLOTS
+
+typedef struct {
+    Arena arenas[ARENA_EPOCH_SLOTS];
+    void *roots[ARENA_EPOCH_SLOTS];
+    // Readers inside the epoch of every slot, aligned and padded so the counters don't share cache
+    // lines with each other or with the fields around them
+    ARENA_CACHE_ALIGNED union {
+        size_t count;
+        char padding[ARENA_CACHE_LINE_SIZE];
+    } readers[ARENA_EPOCH_SLOTS];
+    size_t epoch; // the last published one, lives in arenas[epoch%ARENA_EPOCH_SLOTS]
+} Arena_Epoch;
+
+// Readers, thread safe. Pin the current epoch, read its root and the data it points to, then leave.
+size_t arena_epoch_enter(Arena_Epoch *e);
+void *arena_epoch_root(Arena_Epoch *e, size_t epoch);
+void arena_epoch_leave(Arena_Epoch *e, size_t epoch);
+// The writer, only one at a time. Get the arena of the next epoch, reset and ready to be filled,
+// or NULL if readers of its previous epoch are still around. arena_epoch_begin() waits for them.
+Arena *arena_epoch_try_begin(Arena_Epoch *e);
+Arena *arena_epoch_begin(Arena_Epoch *e);
+// Make what was built in the arena from arena_epoch_begin() the current version
+void arena_epoch_publish(Arena_Epoch *e, void *root);
+// Not thread safe
+void arena_epoch_free(Arena_Epoch *e);
+#endif // ARENA_EPOCH
+
+#ifdef ARENA_QUEUE
+// With ARENA_QUEUE defined there is a lock-free multi-producer single-consumer message queue whose
+// messages are bump allocated in regions owned by their producers (requires GCC or Clang atomics).
+// Once the consumer has released every message of a region it goes back to its producer for reuse,
+// so passing messages never calls malloc() after warming up.
+typedef struct Arena_Message Arena_Message;
+
+// Header in front of every payload
+struct Arena_Message {
+    Arena_Message *next;
+    Region *region;
+    size_t size;
+};
+
+typedef struct {
+    Arena_Message *head; // where producers push
+    char padding[64];    // keep the producers and the consumer off each other's cache line
+    Arena_Message *tail; // where the consumer pops, only touched by the consumer
+    Arena_Message stub;
+} Arena_Queue;
+
+// One per producing thread
+typedef struct {
+    Arena_Queue *queue;
+    Region *region;   // being filled
+    size_t messages;  // allocated in it so far
+    Region *returned; // drained by the consumer, lock-free stack linked through the regions
+    Region *spare;    // taken from `returned`, only touched by the producer
+} Arena_Producer;
+
+void arena_queue_init(Arena_Queue *q);
+void arena_producer_init(Arena_Producer *p, Arena_Queue *q);
+// Allocate a message of `size_bytes`, fill it in and push it. Every message allocated has to be
+// pushed eventually or its region never gets back to the producer.
+void *arena_queue_alloc(Arena_Producer *p, size_t size_bytes);
+void arena_queue_push(Arena_Producer *p, void *message);
+// Consumer only. Returns the oldest message or NULL if there is none (or a push is still half way
+// through), optionally storing its size. Release it when done with it.
+void *arena_queue_pop(Arena_Queue *q, size_t *size_bytes);
+void arena_queue_release(void *message);
+// Give all the regions of the producer back to the backend. Only after the consumer has released
+// all of its messages.
+void arena_producer_free(Arena_Producer *p);
+#endif // ARENA_QUEUE
+
+#ifdef ARENA_FILE
+// With ARENA_FILE defined an arena can live in a file that is mapped with MAP_SHARED (POSIX only).
+// The file is always mapped at the same address, so everything allocated in the arena, pointers
+// included, is there as is for the next process that opens the file. The arena is fixed: it has
+// one region as big as the file and arena_alloc() returns NULL once it is full. The file is
+// created sparse, so only the pages the arena has touched take up space on disk.
+#define ARENA_FILE_VERSION 1
+#define ARENA_FILE_HEADER_SIZE 64 // the Region of the arena starts right after that
+
+typedef struct {
+    char magic[8];       // "ARENAFL"
+    uint32_t version;    // ARENA_FILE_VERSION
+    uint32_t word_size;  // sizeof(uintptr_t) of the process that created the file
+    void *base;          // where the file is mapped, the same in every process
+    size_t size;         // size of the file and of the mapping
+    void *root;          // for the user, e.g. the top level structure to find after reopening
+} Arena_File_Header;
+
+typedef struct {
+    Arena arena;
+    Arena_File_Header *header; // the start of the mapping
+    int fd;
+} Arena_File;
+
+// Open the arena in the file at `path`, creating the file if it doesn't exist or is empty. A new
+// file gets `size_bytes` rounded up to whole pages and is mapped at `base`, or wherever the kernel
+// wants if it is NULL. An existing file is mapped at the base and with the size recorded in its
+// header, and `size_bytes` and `base` are ignored. Returns 0 with errno set on failure, including
+// when the recorded base is taken by another mapping of this process. Pick a base far away from
+// everything else, e.g. (void*)0x200000000000 on 64-bit Linux, for files that are reopened often.
+int arena_file_open(Arena_File *f, const char *path, size_t size_bytes, void *base);
+// Same as arena_file_open() but over a file that is already open for reading and writing. The
+// Arena_File owns `fd` if it succeeds. `base` may be ARENA_FILE_ANYWHERE to map an existing file
+// wherever the kernel wants, in which case pointers stored in the arena are meaningless and the
+// data has to use offsets instead (see arena_file_offset()).
+int arena_file_open_fd(Arena_File *f, int fd, size_t size_bytes, void *base);
+#define ARENA_FILE_ANYWHERE ((void*)(uintptr_t)-1)
+// Create an anonymous arena file in memory with memfd_create() (shm_open() outside of Linux) to
+// share an arena with other processes. The producer fills it in, the consumers get f->fd by fork(),
+// exec() (the descriptor is not close-on-exec), SCM_RIGHTS or /proc/<pid>/fd/<fd> and open it
+// with arena_file_open_fd(), which maps it at the same base, so they read it with zero copies.
+int arena_file_create_shared(Arena_File *f, const char *name, size_t size_bytes, void *base);
+// Convert between pointers into the arena and offsets from the start of the file, which are the
+// same in every process no matter where it mapped the file.
+#define arena_file_offset(f, ptr) ((size_t)((char*)(ptr) - (char*)(f)->header))
+#define arena_file_pointer(f, offset) ((void*)((char*)(f)->header + (offset)))
+// Write the header and the used part of the arena back to the file, with msync(). `async` only
+// schedules the writes. Returns 0 with errno set on failure.
+int arena_file_sync(Arena_File *f, int async);
+// Unmap and close the file. Doesn't sync, the kernel still writes the pages back eventually.
+void arena_file_close(Arena_File *f);
+#endif // ARENA_FILE
+
+#ifndef ARENA_NOSTDIO
+// Snapshots copy everything allocated in an arena into a compact file that can be loaded back
+// into any arena, at any address. Every pointer stored in the arena that points into the arena
+// itself has to be registered in an Arena_Relocs with arena_reloc() before saving, so loading
+// can fix it up. Unregistered pointers come back as garbage.
+#define ARENA_SNAPSHOT_VERSION 1
+
+typedef struct {
+    void ***items;
+    size_t count;
+    size_t capacity;
+} Arena_Relocs;
+
+// Register the pointer stored at `slot` (which lives in the arena being saved). The relocation
+// table itself is allocated in the arena `a`, which is better not the one being saved.
+#define arena_reloc(a, relocs, slot) arena_da_append(a, relocs, (void**)(slot))
+
+// Save the arena into the file at `path`. `root` is a pointer into the arena (or NULL) that
+// arena_load() gives back. `relocs` may be NULL. Returns 0 with errno set on failure, which
+// includes registered pointers that point outside of the arena (EINVAL).
+int arena_save(Arena *a, const char *path, void *root, Arena_Relocs *relocs);
+// Allocate one block in `a`, read the snapshot at `path` into it and fix up its pointers.
+// Returns 0 with errno set on failure (EINVAL for a corrupted or truncated file), leaving `a` as
+// it was, otherwise stores the root in `*root` (if not NULL).
+int arena_load(Arena *a, const char *path, void **root);
+#endif // ARENA_NOSTDIO
 
 #ifndef ARENA_DA_INIT_CAP
 #define ARENA_DA_INIT_CAP 256
@@ -141,54 +585,539 @@ void arena_trim(Arena *a);
 // use it a NULL-terminated C string
 #define arena_sb_append_null(a, sb) arena_da_append(a, sb, 0)
 
+// Hash Map is any structure that has at least three fields: items, count, and capacity, just like
+// a Dynamic Array. The type of `items` MUST have the key as its first field, named `key`, and keys
+// are hashed and compared byte by byte, so they must not contain padding (pointers compare by
+// address, see arena_intern() for strings). The table lives in one block of the arena: `capacity`
+// items followed by a control byte per item, probed 16 at a time Swiss table style (with SSE2
+// where available). Growing reallocates the block in place when it is the last allocation of the
+// arena, so a map that is being filled doesn't leave its old tables behind.
+typedef struct {
+    // Hash of the key stored in `item`
+    uint64_t (*hash)(const void *item, size_t key_size);
+    // Whether `item` holds `key`
+    int (*eq)(const void *item, const void *key, size_t key_size);
+} Arena_HM_Ops;
+
+#define ARENA_HM_GROUP_SIZE 16
+
+uint64_t arena_hash_bytes(const void *data, size_t size);
+// The generic part behind the arena_hm_* macros. Finds the item with `key` that has the given
+// `hash`. If it is not there and `inserted` is not NULL, takes a free slot for it (growing the
+// table if needed) and sets *inserted, leaving it to the caller to fill it in. Returns NULL if
+// the key is not there, or the arena ran out of memory.
+void *arena_hm_probe(Arena *a, void **items, size_t *count, size_t *capacity, size_t item_size,
+                     const Arena_HM_Ops *ops, const void *key, size_t key_size, uint64_t hash, int *inserted);
+void *arena_hm_put_bytes(Arena *a, void **items, size_t *count, size_t *capacity, size_t item_size, const void *key, size_t key_size);
+void *arena_hm_get_bytes(void *items, size_t capacity, size_t item_size, const void *key, size_t key_size);
+void arena_hm_rewind_bytes(Arena *a, void **items, size_t *count, size_t *capacity, size_t item_size, Arena_Mark m);
+
+// Get the item with the key at `key_ptr`, adding it zero initialized (apart from the key) if it's
+// not there. NULL if the arena ran out of memory.
+#define arena_hm_put(a, hm, key_ptr)                                                              \
+    (cast_ptr((hm)->items)arena_hm_put_bytes(                                                     \
+        (a), (void**)&(hm)->items, &(hm)->count, &(hm)->capacity,                                 \
+        sizeof(*(hm)->items), (key_ptr), sizeof((hm)->items->key)))
+
+// Get the item with the key at `key_ptr` or NULL if it's not there
+#define arena_hm_get(hm, key_ptr)                                                                 \
+    (cast_ptr((hm)->items)arena_hm_get_bytes(                                                     \
+        (hm)->items, (hm)->capacity, sizeof(*(hm)->items), (key_ptr), sizeof((hm)->items->key)))
+
+// arena_rewind() that also empties the map if any part of its table is thrown away by rewinding
+#define arena_hm_rewind(a, hm, m)                                                                 \
+    arena_hm_rewind_bytes((a), (void**)&(hm)->items, &(hm)->count, &(hm)->capacity,              \
+                          sizeof(*(hm)->items), (m))
+
+// String interning. Equal strings interned into the same table come back as the same pointer, so
+// they can be compared and hashed by address, e.g. as keys of the hash maps above. The copies are
+// NUL terminated and packed back to back into chunks allocated from the arena, at least
+// ARENA_INTERN_CHUNK_SIZE bytes and growing with the table. Rewinding the arena past any of them
+// invalidates the whole table.
+#ifndef ARENA_INTERN_CHUNK_SIZE
+#define ARENA_INTERN_CHUNK_SIZE 4096
+#endif // ARENA_INTERN_CHUNK_SIZE
+
+typedef struct {
+    const char *str;
+    size_t len;
+    uint64_t hash;
+} Arena_Interned;
+
+typedef struct {
+    Arena_Interned *items;
+    size_t count;
+    size_t capacity;
+    char *chunk;
+    size_t chunk_left;
+} Arena_Intern_Table;
+
+// NULL if the arena ran out of memory
+const char *arena_intern(Arena *a, Arena_Intern_Table *t, const char *str, size_t len);
+const char *arena_intern_cstr(Arena *a, Arena_Intern_Table *t, const char *cstr);
+
+#ifdef __cplusplus
+}
+
+extern "C++" {
+// Keys must be trivially copyable and without padding, same as for the macros
+template <typename K, typename V>
+struct Arena_Hash_Map {
+    struct Item {
+        K key;
+        V value;
+    };
+    Item *items = nullptr;
+    size_t count = 0;
+    size_t capacity = 0;
+
+    V *get(const K &key) { Item *item = arena_hm_get(this, &key); return item ? &item->value : nullptr; }
+    V *put(Arena *a, const K &key) { Item *item = arena_hm_put(a, this, &key); return item ? &item->value : nullptr; }
+    void rewind(Arena *a, Arena_Mark m) { arena_hm_rewind(a, this, m); }
+};
+}
+#endif // __cplusplus
+
 #endif // ARENA_H_
 
 #ifdef ARENA_IMPLEMENTATION
 
-#if ARENA_BACKEND == ARENA_BACKEND_LIBC_MALLOC
+// Static tracepoints in the style of <sys/sdt.h> (SystemTap/USDT), enabled by defining ARENA_USDT.
+// Each probe is a single nop plus an ELF note describing where its arguments live, so it costs
+// nothing until a tracer attaches to it:
+//
+//     $ bpftrace -e 'usdt:./main:arena:new_region { printf("%p %d %d\n", arg0, arg1, arg2); }'
+//
+// Provider is "arena". Probes:
+// - new_region(Region *r, size_t size_bytes, size_t capacity)
+// - free_region(Region *r, size_t size_bytes, size_t capacity)
+// - grow_region(Region *r, size_t size_bytes, size_t capacity)
+// - alloc_refill(Arena *a, size_t size_bytes, size_t capacity) - arena_alloc() had to get a new region
+#if defined(ARENA_USDT) && defined(__GNUC__) && defined(__ELF__) && (defined(__x86_64__) || defined(__aarch64__))
+#define ARENA_PROBE3(name, arg1, arg2, arg3)                                                 \
+    __asm__ __volatile__ (                                                                   \
+        "990: nop\n"                                                                         \
+        ".pushsection .note.stapsdt,\"?\",\"note\"\n"                                        \
+        ".balign 4\n"                                                                        \
+        ".4byte 992f-991f, 994f-993f, 3\n"                                                   \
+        "991: .asciz \"stapsdt\"\n"                                                          \
+        "992: .balign 4\n"                                                                   \
+        "993: .8byte 990b\n"                                                                 \
+        ".8byte _.stapsdt.base\n"                                                            \
+        ".8byte 0\n"                                                                         \
+        ".asciz \"arena\"\n"                                                                 \
+        ".asciz \"" #name "\"\n"                                                             \
+        ".asciz \"8@%0 8@%1 8@%2\"\n"                                                        \
+        "994: .balign 4\n"                                                                   \
+        ".popsection\n"                                                                      \
+        ".ifndef _.stapsdt.base\n"                                                           \
+        ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"              \
+        ".weak _.stapsdt.base\n"                                                             \
+        ".hidden _.stapsdt.base\n"                                                           \
+        "_.stapsdt.base: .space 1\n"                                                         \
+        ".size _.stapsdt.base, 1\n"                                                          \
+        ".popsection\n"                                                                      \
+        ".endif\n"                                                                           \
+        :: "r"((uintptr_t)(arg1)), "r"((uintptr_t)(arg2)), "r"((uintptr_t)(arg3)))
+#else
+#define ARENA_PROBE3(name, arg1, arg2, arg3) ((void)0)
+#endif // ARENA_USDT
+
+#ifdef ARENA_STATS
+#ifdef __unix__
+#include <sys/resource.h>
+#endif // __unix__
+Arena_Stats arena_stats = {0};
+#define ARENA_STATS_ADD(field, n) (arena_stats.field += (n))
+
+#if defined(__linux__) && !defined(ARENA_NOSTDIO)
+size_t arena_stats_thp_bytes(Arena *a)
+{
+    FILE *f = fopen("/proc/self/smaps", "r");
+    if (f == NULL) return 0;
+
+    size_t result = 0;
+    int counted = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long begin, end;
+        size_t kb;
+        char c;
+        if (sscanf(line, "%lx-%lx%c", &begin, &end, &c) == 3 && c == ' ') {
+            // A new mapping, counted if any region of the arena overlaps it
+            counted = 0;
+            for (Region *r = a->begin; r != NULL && !counted; r = r->next) {
+                uintptr_t r_begin = (uintptr_t)r;
+                uintptr_t r_end = (uintptr_t)&r->data[r->capacity];
+                counted = r_begin < end && begin < r_end;
+            }
+        } else if (counted && sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) {
+            result += kb*1024;
+        }
+    }
+    fclose(f);
+    return result;
+}
+#endif // __linux__ && !ARENA_NOSTDIO
+#else
+#define ARENA_STATS_ADD(field, n) ((void)0)
+#endif // ARENA_STATS
+
+// Write to every page of [p, p + size_bytes) so the kernel backs it with memory right now.
+// Only ever call it on memory that doesn't hold anything yet.
+static void arena_prefault_pages(void *p, size_t size_bytes)
+{
+    volatile char *bytes = (volatile char*)p;
+    for (size_t i = 0; i < size_bytes; i += 4096) {
+        bytes[i] = 0;
+    }
+    if (size_bytes > 0) bytes[size_bytes - 1] = 0;
+}
+
+#ifndef ARENA_THREAD_LOCAL
+#if defined(__cplusplus)
+#define ARENA_THREAD_LOCAL thread_local
+#elif defined(_MSC_VER)
+#define ARENA_THREAD_LOCAL __declspec(thread)
+#else
+#define ARENA_THREAD_LOCAL _Thread_local
+#endif
+#endif // ARENA_THREAD_LOCAL
+
+#if defined(ARENA_NUMA) || (defined(ARENA_FILE) && defined(__linux__))
+#include <unistd.h>
+// Declared by <unistd.h> only with _DEFAULT_SOURCE (or _GNU_SOURCE), which strict ISO C modes such
+// as -std=c11 leave out
+#if !defined(_DEFAULT_SOURCE) && !defined(_GNU_SOURCE) && !defined(_BSD_SOURCE)
+extern long syscall(long number, ...);
+#endif
+#endif
+
+// Every backend is compiled when it is selected with ARENA_BACKEND. With ARENA_RUNTIME_BACKENDS
+// all the backends the platform supports are compiled, so arenas can also pick them at runtime.
+
+#if ARENA_BACKEND == ARENA_BACKEND_LIBC_MALLOC || (defined(ARENA_RUNTIME_BACKENDS) && !defined(__wasm__))
 #include <stdlib.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif // _WIN32
+
+// Alignment of Region.data for the regions of ARENA_BACKEND_LIBC_MALLOC. Must be a power of two and
+// a multiple of sizeof(void*). The Region header goes right before the aligned data, so a region
+// wastes up to ARENA_MALLOC_ALIGNMENT - sizeof(Region) bytes in front of it.
+#ifndef ARENA_MALLOC_ALIGNMENT
+#define ARENA_MALLOC_ALIGNMENT 4096
+#endif // ARENA_MALLOC_ALIGNMENT
+
+// Bytes between the start of the allocated block and Region.data
+#define ARENA_MALLOC_HEADER_SIZE ((sizeof(Region) + ARENA_MALLOC_ALIGNMENT - 1)/ARENA_MALLOC_ALIGNMENT*ARENA_MALLOC_ALIGNMENT)
+
+// Which aligned allocator the libc has. posix_memalign() is only declared when POSIX is asked for
+// (strict -std=c99/c11 doesn't) and aligned_alloc() only since C11, so as the last resort the
+// block is over-allocated with malloc() and the pointer to free() is kept right before it.
+#if defined(_WIN32)
+#define ARENA_MALLOC_WIN32
+#elif defined(__APPLE__) || (defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200112L)
+#define ARENA_MALLOC_POSIX_MEMALIGN
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define ARENA_MALLOC_ALIGNED_ALLOC
+#else
+#define ARENA_MALLOC_OVERALLOCATE
+#endif
 
 // TODO: instead of accepting specific capacity new_region() should accept the size of the object we want to fit into the region
 // It should be up to new_region() to decide the actual capacity to allocate
-Region *new_region(size_t capacity)
+static Region *arena_libc_malloc_new_region(size_t capacity)
 {
-    size_t size_bytes = sizeof(Region) + sizeof(uintptr_t)*capacity;
-    // TODO: it would be nice if we could guarantee that the regions are allocated by ARENA_BACKEND_LIBC_MALLOC are page aligned
-    Region *r = (Region*)malloc(size_bytes);
-    ARENA_ASSERT(r); // TODO: since ARENA_ASSERT is disableable go through all the places where we use it to check for failed memory allocation and return with NULL there.
+    ARENA_ASSERT((ARENA_MALLOC_ALIGNMENT & (ARENA_MALLOC_ALIGNMENT - 1)) == 0);
+    ARENA_ASSERT(ARENA_MALLOC_ALIGNMENT%sizeof(void*) == 0);
+    size_t size_bytes = ARENA_MALLOC_HEADER_SIZE + sizeof(uintptr_t)*capacity;
+    // aligned_alloc() wants whole multiples of the alignment and whatever we round up to is ours anyway
+    size_bytes = (size_bytes + ARENA_MALLOC_ALIGNMENT - 1)/ARENA_MALLOC_ALIGNMENT*ARENA_MALLOC_ALIGNMENT;
+    capacity = (size_bytes - ARENA_MALLOC_HEADER_SIZE)/sizeof(uintptr_t);
+#if defined(ARENA_MALLOC_WIN32)
+    char *base = (char*)_aligned_malloc(size_bytes, ARENA_MALLOC_ALIGNMENT);
+#elif defined(ARENA_MALLOC_POSIX_MEMALIGN)
+    char *base = NULL;
+    if (posix_memalign((void**)&base, ARENA_MALLOC_ALIGNMENT, size_bytes) != 0) base = NULL;
+#elif defined(ARENA_MALLOC_ALIGNED_ALLOC)
+    char *base = (char*)aligned_alloc(ARENA_MALLOC_ALIGNMENT, size_bytes);
+#else
+    char *base = NULL;
+    char *block = (char*)malloc(size_bytes + ARENA_MALLOC_ALIGNMENT + sizeof(void*));
+    if (block != NULL) {
+        base = (char*)(((uintptr_t)block + sizeof(void*) + ARENA_MALLOC_ALIGNMENT - 1) & ~(uintptr_t)(ARENA_MALLOC_ALIGNMENT - 1));
+        ((void**)base)[-1] = block;
+    }
+#endif
+    ARENA_ASSERT(base); // TODO: since ARENA_ASSERT is disableable go through all the places where we use it to check for failed memory allocation and return with NULL there.
+#ifdef ARENA_PREFAULT
+    arena_prefault_pages(base, size_bytes);
+#endif // ARENA_PREFAULT
+    Region *r = (Region*)(base + ARENA_MALLOC_HEADER_SIZE - sizeof(Region));
     r->next = NULL;
     r->count = 0;
+    r->flags = 0;
     r->capacity = capacity;
+    ARENA_PROBE3(new_region, r, size_bytes, capacity);
+    ARENA_STATS_ADD(regions_allocated, 1);
     return r;
 }
 
-void free_region(Region *r)
+static void arena_libc_malloc_free_region(Region *r)
 {
-    free(r);
+    ARENA_PROBE3(free_region, r, ARENA_MALLOC_HEADER_SIZE + sizeof(uintptr_t)*r->capacity, r->capacity);
+    ARENA_STATS_ADD(regions_freed, 1);
+    char *base = (char*)r + sizeof(Region) - ARENA_MALLOC_HEADER_SIZE;
+#if defined(ARENA_MALLOC_WIN32)
+    _aligned_free(base);
+#elif defined(ARENA_MALLOC_OVERALLOCATE)
+    free(((void**)base)[-1]);
+#else
+    free(base);
+#endif
 }
-#elif ARENA_BACKEND == ARENA_BACKEND_LINUX_MMAP
+#endif // ARENA_BACKEND_LIBC_MALLOC
+
+#if ARENA_BACKEND == ARENA_BACKEND_LINUX_MMAP || (defined(ARENA_RUNTIME_BACKENDS) && defined(__linux__))
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 
-Region *new_region(size_t capacity)
+#define ARENA_HUGEPAGES_NONE 0
+// Map regions with MAP_HUGETLB out of the preallocated hugetlbfs pool (see /proc/sys/vm/nr_hugepages),
+// falling back to regular pages when the pool is exhausted.
+#define ARENA_HUGEPAGES_HUGETLB 1
+// Align regions to ARENA_HUGEPAGE_SIZE and madvise(MADV_HUGEPAGE) them for Transparent Huge Pages.
+#define ARENA_HUGEPAGES_MADVISE 2
+
+#ifndef ARENA_MMAP_HUGEPAGES
+#define ARENA_MMAP_HUGEPAGES ARENA_HUGEPAGES_NONE
+#endif // ARENA_MMAP_HUGEPAGES
+
+#ifndef ARENA_HUGEPAGE_SIZE
+#define ARENA_HUGEPAGE_SIZE ((size_t)2*1024*1024)
+#endif // ARENA_HUGEPAGE_SIZE
+
+#ifdef ARENA_PREFAULT
+#define ARENA_MMAP_FLAGS (MAP_ANONYMOUS | MAP_PRIVATE | MAP_POPULATE)
+#else
+#define ARENA_MMAP_FLAGS (MAP_ANONYMOUS | MAP_PRIVATE)
+#endif // ARENA_PREFAULT
+
+// Regions are mapped in whole pages of this size and their capacity is rounded up to use all of them
+static size_t arena_mmap_page_size(int hugepages)
+{
+    if (hugepages != ARENA_HUGEPAGES_NONE) return ARENA_HUGEPAGE_SIZE;
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+// mmap() only guarantees page alignment, so map a bit more and cut off the misaligned head and tail.
+static void *arena_mmap_aligned(size_t size_bytes, size_t alignment)
+{
+    char *p = (char*)mmap(NULL, size_bytes + alignment, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (p == MAP_FAILED) return MAP_FAILED;
+    char *aligned = (char*)(((uintptr_t)p + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    if (aligned > p) munmap(p, aligned - p);
+    munmap(aligned + size_bytes, p + alignment - aligned);
+    return aligned;
+}
+
+static Region *arena_linux_mmap_new_region(size_t capacity, int hugepages)
 {
-    size_t size_bytes = sizeof(Region) + sizeof(uintptr_t) * capacity;
-    Region *r = mmap(NULL, size_bytes, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    size_t page_size = arena_mmap_page_size(hugepages);
+    size_t size_bytes = (sizeof(Region) + sizeof(uintptr_t) * capacity + page_size - 1)/page_size*page_size;
+    capacity = (size_bytes - sizeof(Region))/sizeof(uintptr_t);
+
+    Region *r;
+    if (hugepages == ARENA_HUGEPAGES_HUGETLB) {
+        int flags = ARENA_MMAP_FLAGS | MAP_HUGETLB;
+#ifdef MAP_HUGE_SHIFT
+        flags |= __builtin_ctzll(ARENA_HUGEPAGE_SIZE) << MAP_HUGE_SHIFT;
+#endif
+        r = (Region*)mmap(NULL, size_bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (r != MAP_FAILED) {
+            ARENA_STATS_ADD(hugetlb_regions, 1);
+        } else {
+            ARENA_STATS_ADD(hugetlb_fallbacks, 1);
+            r = (Region*)mmap(NULL, size_bytes, PROT_READ | PROT_WRITE, ARENA_MMAP_FLAGS, -1, 0);
+        }
+    } else if (hugepages == ARENA_HUGEPAGES_MADVISE) {
+        r = (Region*)arena_mmap_aligned(size_bytes, ARENA_HUGEPAGE_SIZE);
+        if (r != MAP_FAILED && madvise(r, size_bytes, MADV_HUGEPAGE) == 0) {
+            ARENA_STATS_ADD(thp_advised_regions, 1);
+        }
+#ifdef ARENA_PREFAULT
+        // Not MAP_POPULATE, that would fault in regular pages before the region is advised
+        if (r != MAP_FAILED) arena_prefault_pages(r, size_bytes);
+#endif // ARENA_PREFAULT
+    } else {
+        r = (Region*)mmap(NULL, size_bytes, PROT_READ | PROT_WRITE, ARENA_MMAP_FLAGS, -1, 0);
+    }
     ARENA_ASSERT(r != MAP_FAILED);
     r->next = NULL;
     r->count = 0;
+    r->flags = 0;
     r->capacity = capacity;
+    ARENA_PROBE3(new_region, r, size_bytes, capacity);
+    ARENA_STATS_ADD(regions_allocated, 1);
     return r;
 }
 
-void free_region(Region *r)
+static void arena_linux_mmap_free_region(Region *r)
 {
     size_t size_bytes = sizeof(Region) + sizeof(uintptr_t) * r->capacity;
+    ARENA_PROBE3(free_region, r, size_bytes, r->capacity);
+    ARENA_STATS_ADD(regions_freed, 1);
     int ret = munmap(r, size_bytes);
     ARENA_ASSERT(ret == 0);
 }
 
-#elif ARENA_BACKEND == ARENA_BACKEND_WIN32_VIRTUALALLOC
+// The pages past r->count go back to the kernel and come back zeroed when they are touched again
+static void arena_linux_mmap_decommit_region(Region *r)
+{
+    uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t begin = ((uintptr_t)&r->data[r->count] + page_size - 1) & ~(page_size - 1);
+    uintptr_t end = (uintptr_t)&r->data[r->capacity];
+    // Fails on MAP_HUGETLB regions unless the range is huge page aligned, which is fine
+    if (begin < end) madvise((void*)begin, end - begin, MADV_DONTNEED);
+}
+
+// From <linux/mman.h>. mremap() is called directly since glibc only declares it with _GNU_SOURCE.
+#define ARENA_MREMAP_MAYMOVE_FLAG 1
+
+// Resize the mapping of the region with mremap(). With `maymove` the kernel may move it to another
+// address by remapping its pages, without copying. Returns the region or NULL if it failed.
+static Region *arena_linux_mmap_remap_region(Region *r, size_t capacity, int hugepages, int maymove)
+{
+    size_t page_size = arena_mmap_page_size(hugepages);
+    size_t old_size_bytes = sizeof(Region) + sizeof(uintptr_t)*r->capacity;
+    size_t size_bytes = (sizeof(Region) + sizeof(uintptr_t)*capacity + page_size - 1)/page_size*page_size;
+    if (size_bytes <= old_size_bytes) return r;
+    // Fails on MAP_HUGETLB regions on older kernels, the arena just chains a new region then
+    void *p = (void*)syscall(SYS_mremap, r, old_size_bytes, size_bytes, maymove ? ARENA_MREMAP_MAYMOVE_FLAG : 0);
+    if (p == MAP_FAILED) return NULL;
+    r = (Region*)p;
+#ifdef ARENA_PREFAULT
+    arena_prefault_pages((char*)r + old_size_bytes, size_bytes - old_size_bytes);
+#endif // ARENA_PREFAULT
+    r->capacity = (size_bytes - sizeof(Region))/sizeof(uintptr_t);
+    ARENA_PROBE3(grow_region, r, size_bytes, r->capacity);
+    return r;
+}
+
+static int arena_linux_mmap_grow_region(Region *r, size_t capacity, int hugepages)
+{
+    return arena_linux_mmap_remap_region(r, capacity, hugepages, 0) != NULL;
+}
+
+// Only the compile time ARENA_BACKEND_LINUX_MMAP moves regions, see arena_backend_move_region()
+#if defined(ARENA_MREMAP_MAYMOVE) && ARENA_BACKEND == ARENA_BACKEND_LINUX_MMAP
+static Region *arena_linux_mmap_move_region(Region *r, size_t capacity, int hugepages)
+{
+    return arena_linux_mmap_remap_region(r, capacity, hugepages, 1);
+}
+#endif // ARENA_MREMAP_MAYMOVE && ARENA_BACKEND_LINUX_MMAP
+#endif // ARENA_BACKEND_LINUX_MMAP
+
+#if ARENA_BACKEND == ARENA_BACKEND_LINUX_MMAP_RESERVE || (defined(ARENA_RUNTIME_BACKENDS) && defined(__linux__))
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Every region reserves this much address space with PROT_NONE and commits pages out of it
+// with mprotect() as the arena grows, so an arena stays a single contiguous region until the
+// reservation runs out. Reserving costs no memory, only address space, but that is finite too
+// (128 TiB on x86-64), so when it can't be had the reservation is halved down to what the region
+// commits right away.
+#ifndef ARENA_MMAP_RESERVE_SIZE
+#if SIZE_MAX > 0xFFFFFFFF
+#define ARENA_MMAP_RESERVE_SIZE ((size_t)1024*1024*1024)
+#else
+#define ARENA_MMAP_RESERVE_SIZE ((size_t)64*1024*1024)
+#endif
+#endif // ARENA_MMAP_RESERVE_SIZE
+
+// The reservation of a region is a multiple of the page size, so it is kept in r->flags above
+// the bits of the ARENA_REGION_* flags
+#define ARENA_RESERVE_FLAGS_MASK ((size_t)0xFFF)
+
+static size_t arena_page_round(size_t size_bytes)
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    return (size_bytes + page_size - 1)/page_size*page_size;
+}
+
+static size_t arena_reserve_size(Region *r)
+{
+    return r->flags & ~ARENA_RESERVE_FLAGS_MASK;
+}
+
+static Region *arena_linux_mmap_reserve_new_region(size_t capacity)
+{
+    size_t size_bytes = arena_page_round(sizeof(Region) + sizeof(uintptr_t) * capacity);
+    size_t reserve_bytes = arena_page_round(ARENA_MMAP_RESERVE_SIZE);
+    if (reserve_bytes < size_bytes) reserve_bytes = size_bytes;
+    Region *r;
+    for (;;) {
+        r = (Region*)mmap(NULL, reserve_bytes, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+        if (r != MAP_FAILED || reserve_bytes == size_bytes) break;
+        reserve_bytes = arena_page_round(reserve_bytes/2);
+        if (reserve_bytes < size_bytes) reserve_bytes = size_bytes;
+    }
+    ARENA_ASSERT(r != MAP_FAILED);
+    int ret = mprotect(r, size_bytes, PROT_READ | PROT_WRITE);
+    ARENA_ASSERT(ret == 0);
+#ifdef ARENA_PREFAULT
+    arena_prefault_pages(r, size_bytes);
+#endif // ARENA_PREFAULT
+    r->next = NULL;
+    r->count = 0;
+    r->flags = reserve_bytes | ARENA_REGION_GROWABLE;
+    r->capacity = (size_bytes - sizeof(Region))/sizeof(uintptr_t);
+    ARENA_PROBE3(new_region, r, size_bytes, r->capacity);
+    ARENA_STATS_ADD(regions_allocated, 1);
+    return r;
+}
+
+static void arena_linux_mmap_reserve_free_region(Region *r)
+{
+    size_t size_bytes = sizeof(Region) + sizeof(uintptr_t) * r->capacity;
+    (void) size_bytes;
+    ARENA_PROBE3(free_region, r, size_bytes, r->capacity);
+    ARENA_STATS_ADD(regions_freed, 1);
+    int ret = munmap(r, arena_reserve_size(r));
+    ARENA_ASSERT(ret == 0);
+}
+
+static int arena_linux_mmap_reserve_grow_region(Region *r, size_t capacity)
+{
+    size_t old_size_bytes = sizeof(Region) + sizeof(uintptr_t) * r->capacity;
+    size_t new_size_bytes = arena_page_round(sizeof(Region) + sizeof(uintptr_t) * capacity);
+    if (new_size_bytes <= old_size_bytes) return 1;
+    if (new_size_bytes > arena_reserve_size(r)) return 0;
+    if (mprotect((char*)r + old_size_bytes, new_size_bytes - old_size_bytes, PROT_READ | PROT_WRITE) != 0) return 0;
+#ifdef ARENA_PREFAULT
+    arena_prefault_pages((char*)r + old_size_bytes, new_size_bytes - old_size_bytes);
+#endif // ARENA_PREFAULT
+    r->capacity = (new_size_bytes - sizeof(Region))/sizeof(uintptr_t);
+    ARENA_PROBE3(grow_region, r, new_size_bytes, r->capacity);
+    return 1;
+}
+
+// Uncommit the pages past r->count. The region can grow back into them later.
+static void arena_linux_mmap_reserve_decommit_region(Region *r)
+{
+    size_t old_size_bytes = sizeof(Region) + sizeof(uintptr_t) * r->capacity;
+    size_t new_size_bytes = arena_page_round(sizeof(Region) + sizeof(uintptr_t) * r->count);
+    if (new_size_bytes >= old_size_bytes) return;
+    // Mapping fresh PROT_NONE pages over the tail releases both the memory and the commit charge
+    void *tail = mmap((char*)r + new_size_bytes, old_size_bytes - new_size_bytes, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    if (tail == MAP_FAILED) return;
+    r->capacity = (new_size_bytes - sizeof(Region))/sizeof(uintptr_t);
+}
+#endif // ARENA_BACKEND_LINUX_MMAP_RESERVE
+
+#if ARENA_BACKEND == ARENA_BACKEND_WIN32_VIRTUALALLOC || (defined(ARENA_RUNTIME_BACKENDS) && defined(_WIN32))
 
 #if !defined(_WIN32)
 #  error "Current platform is not Windows"
@@ -199,7 +1128,7 @@ void free_region(Region *r)
 
 #define INV_HANDLE(x)       (((x) == NULL) || ((x) == INVALID_HANDLE_VALUE))
 
-Region *new_region(size_t capacity)
+static Region *arena_win32_virtualalloc_new_region(size_t capacity)
 {
     SIZE_T size_bytes = sizeof(Region) + sizeof(uintptr_t) * capacity;
     Region *r = VirtualAllocEx(
@@ -212,17 +1141,26 @@ Region *new_region(size_t capacity)
     if (INV_HANDLE(r))
         ARENA_ASSERT(0 && "VirtualAllocEx() failed.");
 
+#ifdef ARENA_PREFAULT
+    arena_prefault_pages(r, size_bytes);
+#endif // ARENA_PREFAULT
     r->next = NULL;
     r->count = 0;
+    r->flags = 0;
     r->capacity = capacity;
+    ARENA_PROBE3(new_region, r, size_bytes, capacity);
+    ARENA_STATS_ADD(regions_allocated, 1);
     return r;
 }
 
-void free_region(Region *r)
+static void arena_win32_virtualalloc_free_region(Region *r)
 {
     if (INV_HANDLE(r))
         return;
 
+    ARENA_PROBE3(free_region, r, sizeof(Region) + sizeof(uintptr_t)*r->capacity, r->capacity);
+    ARENA_STATS_ADD(regions_freed, 1);
+
     BOOL free_result = VirtualFreeEx(
         GetCurrentProcess(),        /* Deallocate from current process address space */
         (LPVOID)r,                  /* Address to deallocate */
@@ -233,32 +1171,78 @@ void free_region(Region *r)
     if (FALSE == free_result)
         ARENA_ASSERT(0 && "VirtualFreeEx() failed.");
 }
+#endif // ARENA_BACKEND_WIN32_VIRTUALALLOC
 
-#elif ARENA_BACKEND == ARENA_BACKEND_WASM_HEAPBASE
+#if ARENA_BACKEND == ARENA_BACKEND_WASM_HEAPBASE
 
 // Stolen from https://surma.dev/things/c-to-webassembly/
 
+// The linear memory is accessed through these, so the backend can also run natively over a
+// simulated heap, e.g. a static buffer with ARENA_WASM_MEMORY_BASE pointing at its start.
+#ifndef ARENA_WASM_HEAP_BASE
 extern unsigned char __heap_base;
+#define ARENA_WASM_HEAP_BASE (&__heap_base)
+#endif // ARENA_WASM_HEAP_BASE
+// Address where the linear memory starts, ARENA_WASM_MEMORY_SIZE() is counted from there
+#ifndef ARENA_WASM_MEMORY_BASE
+#define ARENA_WASM_MEMORY_BASE ((uintptr_t)0)
+#endif // ARENA_WASM_MEMORY_BASE
+#ifndef ARENA_WASM_MEMORY_SIZE
+#define ARENA_WASM_MEMORY_SIZE() __builtin_wasm_memory_size(0)
+#endif // ARENA_WASM_MEMORY_SIZE
+// Returns the previous size in pages or a negative value on failure, just like memory.grow
+#ifndef ARENA_WASM_MEMORY_GROW
+#define ARENA_WASM_MEMORY_GROW(delta_pages) __builtin_wasm_memory_grow(0, delta_pages)
+#endif // ARENA_WASM_MEMORY_GROW
+
 // Since ARENA_BACKEND_WASM_HEAPBASE entirely hijacks __heap_base it is expected that no other means of memory
 // allocation are used except the arenas.
-unsigned char* bump_pointer = &__heap_base;
-// TODO: provide a way to deallocate all the arenas at once by setting bump_pointer back to &__heap_base?
+unsigned char* bump_pointer = NULL; // set to ARENA_WASM_HEAP_BASE on the first allocation
+// Regions given back with free_region(), linked through Region.next. The linear memory never
+// shrinks, so they are handed out again by new_region() instead.
+static Region *arena_wasm_free_regions = NULL;
 
 // __builtin_wasm_memory_size and __builtin_wasm_memory_grow are defined in units of page sizes
 #define ARENA_WASM_PAGE_SIZE (64*1024)
 
-Region *new_region(size_t capacity)
+void arena_wasm_heapbase_reset(void)
+{
+    bump_pointer = ARENA_WASM_HEAP_BASE;
+    arena_wasm_free_regions = NULL;
+}
+
+static Region *arena_wasm_heapbase_new_region(size_t capacity)
 {
+    if (bump_pointer == NULL) bump_pointer = ARENA_WASM_HEAP_BASE;
+
+    // The smallest free region that fits, so small arenas don't take the big regions
+    Region **best = NULL;
+    for (Region **it = &arena_wasm_free_regions; *it != NULL; it = &(*it)->next) {
+        if ((*it)->capacity >= capacity && (best == NULL || (*it)->capacity < (*best)->capacity)) {
+            best = it;
+        }
+    }
+    if (best != NULL) {
+        Region *r = *best;
+        *best = r->next;
+        r->next = NULL;
+        r->count = 0;
+        r->flags = 0;
+        ARENA_PROBE3(new_region, r, sizeof(Region) + sizeof(uintptr_t)*r->capacity, r->capacity);
+        ARENA_STATS_ADD(regions_allocated, 1);
+        return r;
+    }
+
     size_t size_bytes = sizeof(Region) + sizeof(uintptr_t)*capacity;
-    Region *r = (void*)bump_pointer;
+    Region *r = (Region*)bump_pointer;
 
     // grow memory brk() style
-    size_t current_memory_size = ARENA_WASM_PAGE_SIZE * __builtin_wasm_memory_size(0);
-    size_t desired_memory_size = (size_t) bump_pointer + size_bytes;
+    size_t current_memory_size = ARENA_WASM_PAGE_SIZE * ARENA_WASM_MEMORY_SIZE();
+    size_t desired_memory_size = ((uintptr_t) bump_pointer - ARENA_WASM_MEMORY_BASE) + size_bytes;
     if (desired_memory_size > current_memory_size) {
         size_t delta_bytes = desired_memory_size - current_memory_size;
         size_t delta_pages = (delta_bytes + (ARENA_WASM_PAGE_SIZE - 1))/ARENA_WASM_PAGE_SIZE;
-        if (__builtin_wasm_memory_grow(0, delta_pages) < 0) {
+        if (ARENA_WASM_MEMORY_GROW(delta_pages) < 0) {
             ARENA_ASSERT(0 && "memory.grow failed");
             return NULL;
         }
@@ -268,126 +1252,908 @@ Region *new_region(size_t capacity)
 
     r->next = NULL;
     r->count = 0;
+    r->flags = 0;
     r->capacity = capacity;
+    ARENA_PROBE3(new_region, r, size_bytes, capacity);
+    ARENA_STATS_ADD(regions_allocated, 1);
     return r;
 }
 
-void free_region(Region *r)
+static void arena_wasm_heapbase_free_region(Region *r)
 {
-    // Since ARENA_BACKEND_WASM_HEAPBASE uses a primitive bump allocator to
-    // allocate the regions, free_region() does nothing. It is generally
-    // not recommended to free arenas anyway since it is better to keep
-    // reusing already allocated memory with arena_reset().
-    (void) r;
+    // It is generally not recommended to free arenas anyway since it is better
+    // to keep reusing already allocated memory with arena_reset(), but if they
+    // are freed the regions are recycled.
+    size_t size_bytes = sizeof(Region) + sizeof(uintptr_t)*r->capacity;
+    ARENA_PROBE3(free_region, r, size_bytes, r->capacity);
+    ARENA_STATS_ADD(regions_freed, 1);
+    if ((unsigned char*)r + size_bytes == bump_pointer) {
+        // The topmost region just goes back to the bump allocator
+        bump_pointer = (unsigned char*)r;
+        return;
+    }
+    r->next = arena_wasm_free_regions;
+    arena_wasm_free_regions = r;
 }
+#endif // ARENA_BACKEND_WASM_HEAPBASE
 
+// The backend selected by ARENA_BACKEND. arena_backend_move_region() grows a region that may end up
+// at another address, it is only used by arena_realloc() and only with ARENA_MREMAP_MAYMOVE.
+#if ARENA_BACKEND == ARENA_BACKEND_LIBC_MALLOC
+#define arena_backend_new_region(capacity)     arena_libc_malloc_new_region(capacity)
+#define arena_backend_free_region(r)           arena_libc_malloc_free_region(r)
+#define arena_backend_grow_region(r, capacity) 0
+#define arena_backend_move_region(r, capacity) NULL
+#define arena_backend_decommit_region(r)       ((void)0)
+#elif ARENA_BACKEND == ARENA_BACKEND_LINUX_MMAP
+#define arena_backend_new_region(capacity)     arena_linux_mmap_new_region(capacity, ARENA_MMAP_HUGEPAGES)
+#define arena_backend_free_region(r)           arena_linux_mmap_free_region(r)
+#define arena_backend_grow_region(r, capacity) arena_linux_mmap_grow_region(r, capacity, ARENA_MMAP_HUGEPAGES)
+#define arena_backend_move_region(r, capacity) arena_linux_mmap_move_region(r, capacity, ARENA_MMAP_HUGEPAGES)
+#define arena_backend_decommit_region(r)       arena_linux_mmap_decommit_region(r)
+#elif ARENA_BACKEND == ARENA_BACKEND_LINUX_MMAP_RESERVE
+#define arena_backend_new_region(capacity)     arena_linux_mmap_reserve_new_region(capacity)
+#define arena_backend_free_region(r)           arena_linux_mmap_reserve_free_region(r)
+#define arena_backend_grow_region(r, capacity) arena_linux_mmap_reserve_grow_region(r, capacity)
+#define arena_backend_move_region(r, capacity) NULL
+#define arena_backend_decommit_region(r)       arena_linux_mmap_reserve_decommit_region(r)
+#elif ARENA_BACKEND == ARENA_BACKEND_WIN32_VIRTUALALLOC
+#define arena_backend_new_region(capacity)     arena_win32_virtualalloc_new_region(capacity)
+#define arena_backend_free_region(r)           arena_win32_virtualalloc_free_region(r)
+#define arena_backend_grow_region(r, capacity) 0
+#define arena_backend_move_region(r, capacity) NULL
+#define arena_backend_decommit_region(r)       ((void)0)
+#elif ARENA_BACKEND == ARENA_BACKEND_WASM_HEAPBASE
+#define arena_backend_new_region(capacity)     arena_wasm_heapbase_new_region(capacity)
+#define arena_backend_free_region(r)           arena_wasm_heapbase_free_region(r)
+#define arena_backend_grow_region(r, capacity) 0
+#define arena_backend_move_region(r, capacity) NULL
+#define arena_backend_decommit_region(r)       ((void)0)
 #else
 #  error "Unknown Arena backend"
 #endif
 
-// TODO: add debug statistic collection mode for arena
-// Should collect things like:
-// - How many times new_region was called
-// - How many times existing region was skipped
-// - How many times allocation exceeded ARENA_REGION_DEFAULT_CAPACITY
-
-void *arena_alloc(Arena *a, size_t size_bytes)
+#ifndef ARENA_REGION_CACHE
+Region *new_region(size_t capacity)
 {
-    size_t size = (size_bytes + sizeof(uintptr_t) - 1)/sizeof(uintptr_t);
-
-    if (a->end == NULL) {
-        ARENA_ASSERT(a->begin == NULL);
-        size_t capacity = ARENA_REGION_DEFAULT_CAPACITY;
-        if (capacity < size) capacity = size;
-        a->end = new_region(capacity);
-        a->begin = a->end;
-    }
-
-    while (a->end->count + size > a->end->capacity && a->end->next != NULL) {
-        a->end = a->end->next;
-    }
-
-    if (a->end->count + size > a->end->capacity) {
-        ARENA_ASSERT(a->end->next == NULL);
-        size_t capacity = ARENA_REGION_DEFAULT_CAPACITY;
-        if (capacity < size) capacity = size;
-        a->end->next = new_region(capacity);
-        a->end = a->end->next;
-    }
-
-    void *result = &a->end->data[a->end->count];
-    a->end->count += size;
-    return result;
+    return arena_backend_new_region(capacity);
 }
 
-void *arena_realloc(Arena *a, void *oldptr, size_t oldsz, size_t newsz)
+void free_region(Region *r)
 {
-    if (newsz <= oldsz) return oldptr;
-    void *newptr = arena_alloc(a, newsz);
-    char *newptr_char = (char*)newptr;
-    char *oldptr_char = (char*)oldptr;
-    for (size_t i = 0; i < oldsz; ++i) {
-        newptr_char[i] = oldptr_char[i];
-    }
-    return newptr;
+    arena_backend_free_region(r);
 }
+#endif // ARENA_REGION_CACHE
 
-size_t arena_strlen(const char *s)
+int grow_region(Region *r, size_t capacity)
 {
-    size_t n = 0;
-    while (*s++) n++;
-    return n;
+    (void) r;
+    (void) capacity;
+    return arena_backend_grow_region(r, capacity);
 }
 
-void *arena_memcpy(void *dest, const void *src, size_t n)
+void decommit_region(Region *r)
 {
-    char *d = dest;
-    const char *s = src;
-    for (; n; n--) *d++ = *s++;
-    return dest;
+    (void) r;
+    arena_backend_decommit_region(r);
 }
 
-char *arena_strdup(Arena *a, const char *cstr)
+#ifdef ARENA_REGION_CACHE
+#include <pthread.h>
+#include <time.h>
+
+// Regions are not cached once the cache holds this many bytes
+#ifndef ARENA_REGION_CACHE_MAX_BYTES
+#define ARENA_REGION_CACHE_MAX_BYTES ((size_t)64*1024*1024)
+#endif // ARENA_REGION_CACHE_MAX_BYTES
+
+// Regions that stayed in the cache longer than that go back to the backend
+#ifndef ARENA_REGION_CACHE_MAX_AGE_MS
+#define ARENA_REGION_CACHE_MAX_AGE_MS 1000
+#endif // ARENA_REGION_CACHE_MAX_AGE_MS
+
+// How many regions each thread keeps for itself before going to the shared cache
+#ifndef ARENA_REGION_CACHE_THREAD_SLOTS
+#define ARENA_REGION_CACHE_THREAD_SLOTS 4
+#endif // ARENA_REGION_CACHE_THREAD_SLOTS
+
+// The slots of a thread hold at most this many bytes, bigger regions go to the shared cache
+#ifndef ARENA_REGION_CACHE_THREAD_MAX_BYTES
+#define ARENA_REGION_CACHE_THREAD_MAX_BYTES (ARENA_REGION_CACHE_MAX_BYTES/16)
+#endif // ARENA_REGION_CACHE_THREAD_MAX_BYTES
+
+// Bucket i holds regions with capacity in [2^i, 2^(i+1)). Cached regions are linked through
+// `next` and keep the time they were cached in `count`.
+#define ARENA_REGION_CACHE_BUCKETS (8*sizeof(size_t))
+
+static struct {
+    pthread_mutex_t mutex;
+    Region *buckets[ARENA_REGION_CACHE_BUCKETS];
+    size_t size_bytes;
+    size_t last_sweep_ms;
+} arena_region_cache = {PTHREAD_MUTEX_INITIALIZER, {0}, 0, 0};
+
+static ARENA_THREAD_LOCAL Region *arena_region_cache_slots[ARENA_REGION_CACHE_THREAD_SLOTS];
+static ARENA_THREAD_LOCAL size_t arena_region_cache_slots_bytes;
+static ARENA_THREAD_LOCAL int arena_region_cache_thread_registered;
+static pthread_key_t arena_region_cache_thread_key;
+static pthread_once_t arena_region_cache_thread_once = PTHREAD_ONCE_INIT;
+
+static size_t arena_region_cache_bucket(size_t capacity)
 {
-    size_t n = arena_strlen(cstr);
-    char *dup = (char*)arena_alloc(a, n + 1);
-    arena_memcpy(dup, cstr, n);
-    dup[n] = '\0';
-    return dup;
+    size_t bucket = 0;
+    while (capacity >>= 1) bucket++;
+    return bucket;
 }
 
-void *arena_memdup(Arena *a, void *data, size_t size)
+static size_t arena_region_cache_now_ms(void)
 {
-    return arena_memcpy(arena_alloc(a, size), data, size);
+    // <time.h> only has clock_gettime() with POSIX enabled, strict ISO C modes fall back to the
+    // wall clock, which is good enough for aging regions
+#if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (size_t)ts.tv_sec*1000 + (size_t)ts.tv_nsec/1000000;
+#elif defined(TIME_UTC)
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (size_t)ts.tv_sec*1000 + (size_t)ts.tv_nsec/1000000;
+#else
+    return (size_t)time(NULL)*1000;
+#endif
 }
 
-#ifndef ARENA_NOSTDIO
-char *arena_vsprintf(Arena *a, const char *format, va_list args)
+static void arena_region_cache_put(Region *r)
 {
-    va_list args_copy;
-    va_copy(args_copy, args);
-    int n = vsnprintf(NULL, 0, format, args_copy);
-    va_end(args_copy);
+    size_t size_bytes = sizeof(Region) + sizeof(uintptr_t)*r->capacity;
+    size_t now = arena_region_cache_now_ms();
+    Region *expired = NULL;
+
+    pthread_mutex_lock(&arena_region_cache.mutex);
+    if (arena_region_cache.size_bytes + size_bytes <= ARENA_REGION_CACHE_MAX_BYTES) {
+        size_t bucket = arena_region_cache_bucket(r->capacity);
+        r->count = now;
+        r->next = arena_region_cache.buckets[bucket];
+        arena_region_cache.buckets[bucket] = r;
+        arena_region_cache.size_bytes += size_bytes;
+        r = NULL;
+    }
 
-    ARENA_ASSERT(n >= 0);
-    char *result = (char*)arena_alloc(a, n + 1);
-    vsnprintf(result, n + 1, format, args);
+    if (now - arena_region_cache.last_sweep_ms >= ARENA_REGION_CACHE_MAX_AGE_MS/2) {
+        arena_region_cache.last_sweep_ms = now;
+        for (size_t i = 0; i < ARENA_REGION_CACHE_BUCKETS; ++i) {
+            Region **p = &arena_region_cache.buckets[i];
+            while (*p) {
+                Region *cached = *p;
+                if (now - cached->count > ARENA_REGION_CACHE_MAX_AGE_MS) {
+                    *p = cached->next;
+                    arena_region_cache.size_bytes -= sizeof(Region) + sizeof(uintptr_t)*cached->capacity;
+                    cached->next = expired;
+                    expired = cached;
+                } else {
+                    p = &cached->next;
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&arena_region_cache.mutex);
+
+    // The backend is called outside of the lock
+    if (r) arena_backend_free_region(r);
+    while (expired) {
+        Region *r0 = expired;
+        expired = expired->next;
+        arena_backend_free_region(r0);
+    }
+}
 
-    return result;
+static Region *arena_region_cache_slot_take(size_t i)
+{
+    Region *r = arena_region_cache_slots[i];
+    arena_region_cache_slots[i] = NULL;
+    arena_region_cache_slots_bytes -= sizeof(Region) + sizeof(uintptr_t)*r->capacity;
+    return r;
 }
 
-char *arena_sprintf(Arena *a, const char *format, ...)
+// Slots keep the time they were filled in `count` too
+static void arena_region_cache_slots_expire(size_t now)
 {
-    va_list args;
-    va_start(args, format);
-    char *result = arena_vsprintf(a, format, args);
-    va_end(args);
+    for (size_t i = 0; i < ARENA_REGION_CACHE_THREAD_SLOTS; ++i) {
+        if (arena_region_cache_slots[i] && now - arena_region_cache_slots[i]->count > ARENA_REGION_CACHE_MAX_AGE_MS) {
+            arena_backend_free_region(arena_region_cache_slot_take(i));
+        }
+    }
+}
 
-    return result;
+// Move the slots of the calling thread to the shared cache, where the other threads can get them
+static void arena_region_cache_release_slots(void)
+{
+    for (size_t i = 0; i < ARENA_REGION_CACHE_THREAD_SLOTS; ++i) {
+        if (arena_region_cache_slots[i]) arena_region_cache_put(arena_region_cache_slot_take(i));
+    }
 }
-#endif // ARENA_NOSTDIO
 
-Arena_Mark arena_snapshot(Arena *a)
+static void arena_region_cache_thread_exit(void *arg)
+{
+    (void) arg;
+    arena_region_cache_release_slots();
+}
+
+static void arena_region_cache_thread_init(void)
+{
+    pthread_key_create(&arena_region_cache_thread_key, arena_region_cache_thread_exit);
+}
+
+Region *new_region(size_t capacity)
+{
+    Region *r = NULL;
+    if (arena_region_cache_slots_bytes > 0) {
+        arena_region_cache_slots_expire(arena_region_cache_now_ms());
+        // The smallest slot that fits, as long as it's not more than twice as big as needed
+        size_t best = ARENA_REGION_CACHE_THREAD_SLOTS;
+        size_t max_bucket = arena_region_cache_bucket(capacity) + 1;
+        for (size_t i = 0; i < ARENA_REGION_CACHE_THREAD_SLOTS; ++i) {
+            Region *slot = arena_region_cache_slots[i];
+            if (slot == NULL || slot->capacity < capacity || arena_region_cache_bucket(slot->capacity) > max_bucket) continue;
+            if (best == ARENA_REGION_CACHE_THREAD_SLOTS || slot->capacity < arena_region_cache_slots[best]->capacity) best = i;
+        }
+        if (best < ARENA_REGION_CACHE_THREAD_SLOTS) r = arena_region_cache_slot_take(best);
+    }
+
+    if (r == NULL) {
+        // Only the bucket of the requested capacity may have regions that are too small. Anything
+        // from the bucket above fits, bigger ones are left for the requests they are good for.
+        size_t bucket = arena_region_cache_bucket(capacity);
+        pthread_mutex_lock(&arena_region_cache.mutex);
+        for (size_t i = bucket; i <= bucket + 1 && i < ARENA_REGION_CACHE_BUCKETS && r == NULL; ++i) {
+            for (Region **p = &arena_region_cache.buckets[i]; *p; p = &(*p)->next) {
+                if ((*p)->capacity >= capacity) {
+                    r = *p;
+                    *p = r->next;
+                    break;
+                }
+            }
+        }
+        if (r) arena_region_cache.size_bytes -= sizeof(Region) + sizeof(uintptr_t)*r->capacity;
+        pthread_mutex_unlock(&arena_region_cache.mutex);
+    }
+
+    if (r == NULL) {
+        ARENA_STATS_ADD(region_cache_misses, 1);
+        return arena_backend_new_region(capacity);
+    }
+
+    ARENA_STATS_ADD(region_cache_hits, 1);
+    r->next = NULL;
+    r->count = 0;
+    return r;
+}
+
+void free_region(Region *r)
+{
+    size_t size_bytes = sizeof(Region) + sizeof(uintptr_t)*r->capacity;
+    size_t now = arena_region_cache_now_ms();
+    arena_region_cache_slots_expire(now);
+    if (arena_region_cache_slots_bytes + size_bytes <= ARENA_REGION_CACHE_THREAD_MAX_BYTES) {
+        for (size_t i = 0; i < ARENA_REGION_CACHE_THREAD_SLOTS; ++i) {
+            if (arena_region_cache_slots[i] == NULL) {
+                if (!arena_region_cache_thread_registered) {
+                    // Only to get arena_region_cache_thread_exit() called when the thread exits
+                    pthread_once(&arena_region_cache_thread_once, arena_region_cache_thread_init);
+                    pthread_setspecific(arena_region_cache_thread_key, &arena_region_cache_thread_registered);
+                    arena_region_cache_thread_registered = 1;
+                }
+                r->count = now;
+                arena_region_cache_slots[i] = r;
+                arena_region_cache_slots_bytes += size_bytes;
+                return;
+            }
+        }
+    }
+    arena_region_cache_put(r);
+}
+
+void arena_region_cache_flush(void)
+{
+    for (size_t i = 0; i < ARENA_REGION_CACHE_THREAD_SLOTS; ++i) {
+        if (arena_region_cache_slots[i]) arena_backend_free_region(arena_region_cache_slot_take(i));
+    }
+
+    Region *flushed = NULL;
+    pthread_mutex_lock(&arena_region_cache.mutex);
+    for (size_t i = 0; i < ARENA_REGION_CACHE_BUCKETS; ++i) {
+        while (arena_region_cache.buckets[i]) {
+            Region *r = arena_region_cache.buckets[i];
+            arena_region_cache.buckets[i] = r->next;
+            r->next = flushed;
+            flushed = r;
+        }
+    }
+    arena_region_cache.size_bytes = 0;
+    pthread_mutex_unlock(&arena_region_cache.mutex);
+
+    while (flushed) {
+        Region *r = flushed;
+        flushed = flushed->next;
+        arena_backend_free_region(r);
+    }
+}
+#endif // ARENA_REGION_CACHE
+
+#ifdef ARENA_RUNTIME_BACKENDS
+static Region *arena_default_backend_new_region(Arena_Backend *b, size_t capacity) { (void) b; return new_region(capacity); }
+static void arena_default_backend_free_region(Arena_Backend *b, Region *r) { (void) b; free_region(r); }
+static int arena_default_backend_grow_region(Arena_Backend *b, Region *r, size_t capacity) { (void) b; return grow_region(r, capacity); }
+static void arena_default_backend_decommit_region(Arena_Backend *b, Region *r) { (void) b; decommit_region(r); }
+
+Arena_Backend arena_backend_default = {
+    arena_default_backend_new_region,
+    arena_default_backend_free_region,
+    arena_default_backend_grow_region,
+    arena_default_backend_decommit_region,
+};
+
+#ifndef __wasm__
+static Region *arena_libc_malloc_backend_new_region(Arena_Backend *b, size_t capacity) { (void) b; return arena_libc_malloc_new_region(capacity); }
+static void arena_libc_malloc_backend_free_region(Arena_Backend *b, Region *r) { (void) b; arena_libc_malloc_free_region(r); }
+
+Arena_Backend arena_backend_libc_malloc = {
+    arena_libc_malloc_backend_new_region,
+    arena_libc_malloc_backend_free_region,
+    NULL,
+    NULL,
+};
+#endif // __wasm__
+
+#ifdef __linux__
+static Region *arena_linux_mmap_backend_new_region(Arena_Backend *b, size_t capacity) { (void) b; return arena_linux_mmap_new_region(capacity, ARENA_HUGEPAGES_NONE); }
+static Region *arena_linux_mmap_hugetlb_backend_new_region(Arena_Backend *b, size_t capacity) { (void) b; return arena_linux_mmap_new_region(capacity, ARENA_HUGEPAGES_HUGETLB); }
+static Region *arena_linux_mmap_thp_backend_new_region(Arena_Backend *b, size_t capacity) { (void) b; return arena_linux_mmap_new_region(capacity, ARENA_HUGEPAGES_MADVISE); }
+static void arena_linux_mmap_backend_free_region(Arena_Backend *b, Region *r) { (void) b; arena_linux_mmap_free_region(r); }
+static void arena_linux_mmap_backend_decommit_region(Arena_Backend *b, Region *r) { (void) b; arena_linux_mmap_decommit_region(r); }
+static int arena_linux_mmap_backend_grow_region(Arena_Backend *b, Region *r, size_t capacity) { (void) b; return arena_linux_mmap_grow_region(r, capacity, ARENA_HUGEPAGES_NONE); }
+static int arena_linux_mmap_hugetlb_backend_grow_region(Arena_Backend *b, Region *r, size_t capacity) { (void) b; return arena_linux_mmap_grow_region(r, capacity, ARENA_HUGEPAGES_HUGETLB); }
+static int arena_linux_mmap_thp_backend_grow_region(Arena_Backend *b, Region *r, size_t capacity) { (void) b; return arena_linux_mmap_grow_region(r, capacity, ARENA_HUGEPAGES_MADVISE); }
+static Region *arena_linux_mmap_reserve_backend_new_region(Arena_Backend *b, size_t capacity) { (void) b; return arena_linux_mmap_reserve_new_region(capacity); }
+static void arena_linux_mmap_reserve_backend_free_region(Arena_Backend *b, Region *r) { (void) b; arena_linux_mmap_reserve_free_region(r); }
+static int arena_linux_mmap_reserve_backend_grow_region(Arena_Backend *b, Region *r, size_t capacity) { (void) b; return arena_linux_mmap_reserve_grow_region(r, capacity); }
+static void arena_linux_mmap_reserve_backend_decommit_region(Arena_Backend *b, Region *r) { (void) b; arena_linux_mmap_reserve_decommit_region(r); }
+
+Arena_Backend arena_backend_linux_mmap = {
+    arena_linux_mmap_backend_new_region,
+    arena_linux_mmap_backend_free_region,
+    arena_linux_mmap_backend_grow_region,
+    arena_linux_mmap_backend_decommit_region,
+};
+
+Arena_Backend arena_backend_linux_mmap_hugetlb = {
+    arena_linux_mmap_hugetlb_backend_new_region,
+    arena_linux_mmap_backend_free_region,
+    arena_linux_mmap_hugetlb_backend_grow_region,
+    arena_linux_mmap_backend_decommit_region,
+};
+
+Arena_Backend arena_backend_linux_mmap_thp = {
+    arena_linux_mmap_thp_backend_new_region,
+    arena_linux_mmap_backend_free_region,
+    arena_linux_mmap_thp_backend_grow_region,
+    arena_linux_mmap_backend_decommit_region,
+};
+
+Arena_Backend arena_backend_linux_mmap_reserve = {
+    arena_linux_mmap_reserve_backend_new_region,
+    arena_linux_mmap_reserve_backend_free_region,
+    arena_linux_mmap_reserve_backend_grow_region,
+    arena_linux_mmap_reserve_backend_decommit_region,
+};
+#endif // __linux__
+
+#ifdef _WIN32
+static Region *arena_win32_virtualalloc_backend_new_region(Arena_Backend *b, size_t capacity) { (void) b; return arena_win32_virtualalloc_new_region(capacity); }
+static void arena_win32_virtualalloc_backend_free_region(Arena_Backend *b, Region *r) { (void) b; arena_win32_virtualalloc_free_region(r); }
+
+Arena_Backend arena_backend_win32_virtualalloc = {
+    arena_win32_virtualalloc_backend_new_region,
+    arena_win32_virtualalloc_backend_free_region,
+    NULL,
+    NULL,
+};
+#endif // _WIN32
+#endif // ARENA_RUNTIME_BACKENDS
+
+
+#ifdef ARENA_NUMA
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// From <linux/mempolicy.h>. The syscalls are called directly so libnuma is not needed.
+#define ARENA_MPOL_PREFERRED 1
+#define ARENA_MPOL_INTERLEAVE 3
+#define ARENA_MPOL_F_NODE (1<<0)
+#define ARENA_MPOL_F_ADDR (1<<1)
+#define ARENA_MPOL_F_MEMS_ALLOWED (1<<2)
+#define ARENA_MPOL_MF_MOVE (1<<1)
+#define ARENA_NUMA_MAX_NODES 1024
+#define ARENA_NUMA_MASK_BITS (8*sizeof(unsigned long))
+
+void arena_set_numa_policy(Arena *a, int policy, int node)
+{
+    if (policy == ARENA_NUMA_LOCAL) {
+        unsigned int cpu, local_node;
+        if (syscall(SYS_getcpu, &cpu, &local_node, NULL) == 0) {
+            node = (int) local_node;
+        } else {
+            policy = ARENA_NUMA_DEFAULT;
+        }
+    }
+    a->numa_policy = policy;
+    a->numa_node = node;
+}
+
+int arena_region_numa_node(Region *r)
+{
+    int node = -1;
+    if (syscall(SYS_get_mempolicy, &node, NULL, 0, r, ARENA_MPOL_F_NODE | ARENA_MPOL_F_ADDR) != 0) return -1;
+    return node;
+}
+
+// The policy of the arena is set as the policy of the calling thread while the backend creates
+// or grows a region, so the pages it touches right away (the Region header, ARENA_PREFAULT,
+// MAP_POPULATE) are placed by it the first time instead of being migrated afterwards. The region
+// is then bound to the policy with mbind(), so the pages other threads touch later follow it too.
+typedef struct {
+    int bind;
+    int mode;
+    unsigned long mask[ARENA_NUMA_MAX_NODES/ARENA_NUMA_MASK_BITS];
+    int saved;
+    int saved_mode;
+    unsigned long saved_mask[ARENA_NUMA_MAX_NODES/ARENA_NUMA_MASK_BITS];
+} Arena_Numa_Scope;
+
+static void arena_numa_enter(Arena *a, Arena_Numa_Scope *s)
+{
+    s->bind = 0;
+    s->saved = 0;
+    if (a->numa_policy == ARENA_NUMA_DEFAULT) return;
+
+    for (size_t i = 0; i < ARENA_NUMA_MAX_NODES/ARENA_NUMA_MASK_BITS; ++i) s->mask[i] = 0;
+    if (a->numa_policy == ARENA_NUMA_INTERLEAVE) {
+        s->mode = ARENA_MPOL_INTERLEAVE;
+        if (syscall(SYS_get_mempolicy, NULL, s->mask, ARENA_NUMA_MAX_NODES, NULL, ARENA_MPOL_F_MEMS_ALLOWED) != 0) return;
+    } else {
+        s->mode = ARENA_MPOL_PREFERRED;
+        if (a->numa_node < 0 || a->numa_node >= ARENA_NUMA_MAX_NODES) return;
+        s->mask[a->numa_node/ARENA_NUMA_MASK_BITS] = 1UL << (a->numa_node%ARENA_NUMA_MASK_BITS);
+    }
+    s->bind = 1;
+
+    // Failures only mean the policy doesn't apply, so they are ignored
+    if (syscall(SYS_get_mempolicy, &s->saved_mode, s->saved_mask, ARENA_NUMA_MAX_NODES, NULL, 0) != 0) return;
+    if (syscall(SYS_set_mempolicy, s->mode, s->mask, ARENA_NUMA_MAX_NODES) != 0) return;
+    s->saved = 1;
+}
+
+// Restore the policy of the thread and bind [p, p + size_bytes) to the policy of the arena
+static void arena_numa_leave(Arena_Numa_Scope *s, void *p, size_t size_bytes)
+{
+    if (s->saved) syscall(SYS_set_mempolicy, s->saved_mode, s->saved_mask, ARENA_NUMA_MAX_NODES);
+    if (!s->bind || p == NULL) return;
+
+    // mbind() works on whole pages, so only the pages entirely inside of the range are bound.
+    // MPOL_MF_MOVE only has something to do when the backend handed out memory that was touched
+    // before, like a reused malloc() block.
+    uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t begin = ((uintptr_t)p + page_size - 1) & ~(page_size - 1);
+    uintptr_t end = ((uintptr_t)p + size_bytes) & ~(page_size - 1);
+    if (begin >= end) return;
+    syscall(SYS_mbind, begin, end - begin, s->mode, s->mask, ARENA_NUMA_MAX_NODES, ARENA_MPOL_MF_MOVE);
+}
+#endif // ARENA_NUMA
+
+// Allocate a new region for the arena that can fit at least `size` words
+static Region *arena_new_backend_region(Arena *a, size_t capacity)
+{
+#ifdef ARENA_NUMA
+    Arena_Numa_Scope numa;
+    arena_numa_enter(a, &numa);
+#endif // ARENA_NUMA
+#ifdef ARENA_RUNTIME_BACKENDS
+    Region *r = a->backend ? a->backend->new_region(a->backend, capacity) : new_region(capacity);
+#else
+    Region *r = new_region(capacity);
+#endif // ARENA_RUNTIME_BACKENDS
+#ifdef ARENA_NUMA
+    arena_numa_leave(&numa, r, r ? sizeof(Region) + sizeof(uintptr_t)*r->capacity : 0);
+#else
+    (void) a;
+#endif // ARENA_NUMA
+    return r;
+}
+
+#ifdef ARENA_PROVISION
+#include <pthread.h>
+
+static void arena_free_region(Arena *a, Region *r);
+
+static pthread_mutex_t arena_provision_lock = PTHREAD_MUTEX_INITIALIZER; // the list of arenas, held while refilling
+static Arena_Provision *arena_provision_list = NULL;
+static int arena_provision_started = 0;
+static pthread_t arena_provision_helper;
+static pthread_mutex_t arena_provision_wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t arena_provision_wake = PTHREAD_COND_INITIALIZER;
+static int arena_provision_wanted = 0; // set without the lock, but only cleared while holding it
+static int arena_provision_quit = 0;
+
+static void arena_provision_wake_up(void)
+{
+    // Only whoever raises the flag has to signal. Until the helper clears it again, it is
+    // guaranteed to look at the pools once more, so the other takes get away with an atomic.
+    if (__atomic_exchange_n(&arena_provision_wanted, 1, __ATOMIC_ACQ_REL)) return;
+    pthread_mutex_lock(&arena_provision_wake_lock);
+    pthread_cond_signal(&arena_provision_wake);
+    pthread_mutex_unlock(&arena_provision_wake_lock);
+}
+
+static void *arena_provision_thread(void *arg)
+{
+    (void) arg;
+    for (;;) {
+        pthread_mutex_lock(&arena_provision_wake_lock);
+        while (!__atomic_load_n(&arena_provision_wanted, __ATOMIC_ACQUIRE) && !arena_provision_quit) {
+            pthread_cond_wait(&arena_provision_wake, &arena_provision_wake_lock);
+        }
+        int quit = arena_provision_quit;
+        // Exchanged rather than stored, so the helper sees the heads of all the takes that found it set
+        __atomic_exchange_n(&arena_provision_wanted, 0, __ATOMIC_ACQ_REL);
+        pthread_mutex_unlock(&arena_provision_wake_lock);
+        if (quit) break;
+
+        pthread_mutex_lock(&arena_provision_lock);
+        for (Arena_Provision *p = arena_provision_list; p != NULL; p = p->next) {
+            while (p->tail - __atomic_load_n(&p->head, __ATOMIC_ACQUIRE) < ARENA_PROVISION_POOL_SIZE) {
+                Region *r = arena_new_backend_region(p->arena, p->capacity);
+                if (r == NULL) break;
+                arena_prefault_pages(r->data, sizeof(uintptr_t)*r->capacity);
+                p->pool[p->tail%ARENA_PROVISION_POOL_SIZE] = r;
+                __atomic_store_n(&p->tail, p->tail + 1, __ATOMIC_RELEASE);
+            }
+        }
+        pthread_mutex_unlock(&arena_provision_lock);
+#ifdef ARENA_REGION_CACHE
+        // The helper may sleep for good, so nothing may stay in its slots once it goes to sleep
+        arena_region_cache_release_slots();
+#endif // ARENA_REGION_CACHE
+    }
+    return NULL;
+}
+
+void arena_provision_start(Arena *a, Arena_Provision *p, size_t capacity)
+{
+    ARENA_ASSERT(a->provision == NULL);
+    for (size_t i = 0; i < ARENA_PROVISION_POOL_SIZE; ++i) p->pool[i] = NULL;
+    p->head = 0;
+    p->tail = 0;
+    p->capacity = capacity < ARENA_REGION_DEFAULT_CAPACITY ? ARENA_REGION_DEFAULT_CAPACITY : capacity;
+    p->arena = a;
+
+    pthread_mutex_lock(&arena_provision_lock);
+    if (!arena_provision_started) {
+        int ret = pthread_create(&arena_provision_helper, NULL, arena_provision_thread, NULL);
+        ARENA_ASSERT(ret == 0);
+        (void) ret;
+        arena_provision_started = 1;
+    }
+    p->next = arena_provision_list;
+    arena_provision_list = p;
+    pthread_mutex_unlock(&arena_provision_lock);
+
+    a->provision = p;
+    arena_provision_wake_up();
+}
+
+void arena_provision_stop(Arena *a)
+{
+    Arena_Provision *p = a->provision;
+    if (p == NULL) return;
+
+    // The helper only touches the pools while holding the lock, so after this it is ours again
+    pthread_mutex_lock(&arena_provision_lock);
+    for (Arena_Provision **it = &arena_provision_list; *it != NULL; it = &(*it)->next) {
+        if (*it == p) {
+            *it = p->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&arena_provision_lock);
+
+    a->provision = NULL;
+    for (; p->head != p->tail; p->head++) {
+        arena_free_region(a, p->pool[p->head%ARENA_PROVISION_POOL_SIZE]);
+    }
+}
+
+void arena_provision_shutdown(void)
+{
+    pthread_mutex_lock(&arena_provision_lock);
+    ARENA_ASSERT(arena_provision_list == NULL);
+    int started = arena_provision_started;
+    arena_provision_started = 0;
+    pthread_mutex_unlock(&arena_provision_lock);
+    if (!started) return;
+
+    pthread_mutex_lock(&arena_provision_wake_lock);
+    arena_provision_quit = 1;
+    pthread_cond_signal(&arena_provision_wake);
+    pthread_mutex_unlock(&arena_provision_wake_lock);
+    pthread_join(arena_provision_helper, NULL);
+    arena_provision_quit = 0;
+}
+
+// O(1) and lock-free, except for the first take after the helper went to sleep, which locks to
+// wake it up (see arena_provision_wake_up())
+static Region *arena_provision_take(Arena_Provision *p)
+{
+    Region *r = NULL;
+    if (p->head != __atomic_load_n(&p->tail, __ATOMIC_ACQUIRE)) {
+        r = p->pool[p->head%ARENA_PROVISION_POOL_SIZE];
+        __atomic_store_n(&p->head, p->head + 1, __ATOMIC_RELEASE);
+        ARENA_STATS_ADD(provision_hits, 1);
+    } else {
+        ARENA_STATS_ADD(provision_misses, 1);
+    }
+    arena_provision_wake_up();
+    return r;
+}
+#endif // ARENA_PROVISION
+
+static Region *arena_new_region(Arena *a, size_t size)
+{
+    if (a->fixed) return NULL;
+    size_t capacity = ARENA_REGION_DEFAULT_CAPACITY;
+    if (capacity < size) {
+        capacity = size;
+        ARENA_STATS_ADD(oversized_allocs, 1);
+    }
+    ARENA_PROBE3(alloc_refill, a, sizeof(uintptr_t)*size, capacity);
+#ifdef ARENA_PROVISION
+    if (a->provision != NULL && capacity <= a->provision->capacity) {
+        Region *r = arena_provision_take(a->provision);
+        if (r != NULL) return r;
+    }
+#endif // ARENA_PROVISION
+    return arena_new_backend_region(a, capacity);
+}
+
+static int arena_grow_region(Arena *a, Region *r, size_t capacity)
+{
+    if (a->fixed || (r->flags & ARENA_REGION_BORROWED)) return 0;
+    size_t old_capacity = r->capacity;
+    int grown;
+#ifdef ARENA_NUMA
+    Arena_Numa_Scope numa;
+    arena_numa_enter(a, &numa);
+#endif // ARENA_NUMA
+#ifdef ARENA_RUNTIME_BACKENDS
+    if (a->backend) {
+        grown = a->backend->grow_region != NULL && a->backend->grow_region(a->backend, r, capacity);
+    } else {
+        grown = grow_region(r, capacity);
+    }
+#else
+    grown = grow_region(r, capacity);
+#endif // ARENA_RUNTIME_BACKENDS
+#ifdef ARENA_NUMA
+    arena_numa_leave(&numa, grown ? &r->data[old_capacity] : NULL, sizeof(uintptr_t)*(r->capacity - old_capacity));
+#else
+    (void) old_capacity;
+#endif // ARENA_NUMA
+    return grown;
+}
+
+#ifdef ARENA_MREMAP_MAYMOVE
+// Grow the region, letting the backend move it, and update the links to it. Only for regions
+// nothing else points into, since pointers into the region and Arena_Marks of it are not updated.
+static Region *arena_move_region(Arena *a, Region *r, size_t capacity)
+{
+    if (a->fixed || (r->flags & ARENA_REGION_BORROWED)) return NULL;
+#ifdef ARENA_RUNTIME_BACKENDS
+    if (a->backend) return NULL;
+#endif // ARENA_RUNTIME_BACKENDS
+    (void) capacity;
+    size_t old_capacity = r->capacity;
+#ifdef ARENA_NUMA
+    Arena_Numa_Scope numa;
+    arena_numa_enter(a, &numa);
+#endif // ARENA_NUMA
+    Region *moved = arena_backend_move_region(r, capacity);
+#ifdef ARENA_NUMA
+    arena_numa_leave(&numa, moved ? &moved->data[old_capacity] : NULL, moved ? sizeof(uintptr_t)*(moved->capacity - old_capacity) : 0);
+#else
+    (void) old_capacity;
+#endif // ARENA_NUMA
+    if (moved == NULL) return NULL;
+    if (moved != r) {
+        if (a->begin == r) {
+            a->begin = moved;
+        } else {
+            Region *prev = a->begin;
+            while (prev->next != r) prev = prev->next;
+            prev->next = moved;
+        }
+        if (a->end == r) a->end = moved;
+    }
+    return moved;
+}
+#endif // ARENA_MREMAP_MAYMOVE
+
+static void arena_free_region(Arena *a, Region *r)
+{
+    if (r->flags & ARENA_REGION_BORROWED) return;
+#ifdef ARENA_RUNTIME_BACKENDS
+    if (a->backend) {
+        a->backend->free_region(a->backend, r);
+        return;
+    }
+#endif // ARENA_RUNTIME_BACKENDS
+    (void) a;
+    free_region(r);
+}
+
+static void arena_decommit_region(Arena *a, Region *r)
+{
+    if (r->flags & ARENA_REGION_BORROWED) return;
+#ifdef ARENA_RUNTIME_BACKENDS
+    if (a->backend) {
+        if (a->backend->decommit_region) a->backend->decommit_region(a->backend, r);
+        return;
+    }
+#endif // ARENA_RUNTIME_BACKENDS
+    (void) a;
+    decommit_region(r);
+}
+
+void *arena_alloc(Arena *a, size_t size_bytes)
+{
+    size_t size = (size_bytes + sizeof(uintptr_t) - 1)/sizeof(uintptr_t);
+
+    if (a->end == NULL) {
+        ARENA_ASSERT(a->begin == NULL);
+        a->end = arena_new_region(a, size);
+        if (a->end == NULL) return NULL;
+        a->begin = a->end;
+    }
+
+    while (a->end->count + size > a->end->capacity && a->end->next != NULL) {
+        ARENA_STATS_ADD(regions_skipped, 1);
+        a->end = a->end->next;
+    }
+
+    if (a->end->count + size > a->end->capacity) {
+        ARENA_ASSERT(a->end->next == NULL);
+        size_t grow_capacity = a->end->capacity + ARENA_REGION_DEFAULT_CAPACITY;
+        if (grow_capacity < a->end->count + size) grow_capacity = a->end->count + size;
+        // Without room set aside behind the region an in-place mremap() nearly always fails
+        int grow = (a->end->flags & ARENA_REGION_GROWABLE) != 0;
+#ifdef ARENA_PROVISION
+        // A region from the pool is ready to use, growing would fault in fresh pages right here
+        grow = grow && (a->provision == NULL || size > a->provision->capacity);
+#endif // ARENA_PROVISION
+        if (!grow || !arena_grow_region(a, a->end, grow_capacity)) {
+            Region *r = arena_new_region(a, size);
+            if (r == NULL) return NULL;
+            a->end->next = r;
+            a->end = r;
+        }
+    }
+
+    void *result = &a->end->data[a->end->count];
+    a->end->count += size;
+    return result;
+}
+
+void *arena_realloc(Arena *a, void *oldptr, size_t oldsz, size_t newsz)
+{
+    if (newsz <= oldsz) return oldptr;
+
+    // The last allocation of the arena just grows in place, if needed together with its region
+    size_t old_size = (oldsz + sizeof(uintptr_t) - 1)/sizeof(uintptr_t);
+    size_t new_size = (newsz + sizeof(uintptr_t) - 1)/sizeof(uintptr_t);
+    Region *r = a->end;
+    if (oldptr != NULL && r != NULL
+        && (uintptr_t*)oldptr >= r->data
+        && (uintptr_t*)oldptr + old_size == &r->data[r->count]) {
+        size_t count = r->count - old_size + new_size;
+        if (count <= r->capacity) {
+            r->count = count;
+            return oldptr;
+        }
+        size_t grow_capacity = r->capacity + ARENA_REGION_DEFAULT_CAPACITY;
+        if (grow_capacity < count) grow_capacity = count;
+        if (arena_grow_region(a, r, grow_capacity)) {
+            r->count = count;
+            return oldptr;
+        }
+#ifdef ARENA_MREMAP_MAYMOVE
+        if (oldptr == r->data) {
+            r = arena_move_region(a, r, grow_capacity);
+            if (r != NULL) {
+                r->count = count;
+                return r->data;
+            }
+        }
+#endif // ARENA_MREMAP_MAYMOVE
+    }
+
+    void *newptr = arena_alloc(a, newsz);
+    if (newptr == NULL) return NULL;
+    char *newptr_char = (char*)newptr;
+    char *oldptr_char = (char*)oldptr;
+    for (size_t i = 0; i < oldsz; ++i) {
+        newptr_char[i] = oldptr_char[i];
+    }
+    return newptr;
+}
+
+size_t arena_strlen(const char *s)
+{
+    size_t n = 0;
+    while (*s++) n++;
+    return n;
+}
+
+void *arena_memcpy(void *dest, const void *src, size_t n)
+{
+    char *d = (char*)dest;
+    const char *s = (const char*)src;
+    for (; n; n--) *d++ = *s++;
+    return dest;
+}
+
+char *arena_strdup(Arena *a, const char *cstr)
+{
+    size_t n = arena_strlen(cstr);
+    char *dup = (char*)arena_alloc(a, n + 1);
+    if (dup == NULL) return NULL;
+    arena_memcpy(dup, cstr, n);
+    dup[n] = '\0';
+    return dup;
+}
+
+void *arena_memdup(Arena *a, void *data, size_t size)
+{
+    void *dup = arena_alloc(a, size);
+    if (dup == NULL) return NULL;
+    return arena_memcpy(dup, data, size);
+}
+
+#ifndef ARENA_NOSTDIO
+char *arena_vsprintf(Arena *a, const char *format, va_list args)
+{
+    va_list args_copy;
+    va_copy(args_copy, args);
+    int n = vsnprintf(NULL, 0, format, args_copy);
+    va_end(args_copy);
+
+    ARENA_ASSERT(n >= 0);
+    char *result = (char*)arena_alloc(a, n + 1);
+    if (result == NULL) return NULL;
+    vsnprintf(result, n + 1, format, args);
+
+    return result;
+}
+
+char *arena_sprintf(Arena *a, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    char *result = arena_vsprintf(a, format, args);
+    va_end(args);
+
+    return result;
+}
+#endif // ARENA_NOSTDIO
+
+Arena_Mark arena_snapshot(Arena *a)
 {
     Arena_Mark m;
     if(a->end == NULL){ //snapshot of uninitialized arena
@@ -432,20 +2198,1278 @@ void arena_free(Arena *a)
     while (r) {
         Region *r0 = r;
         r = r->next;
-        free_region(r0);
+        arena_free_region(a, r0);
     }
     a->begin = NULL;
     a->end = NULL;
 }
 
-void arena_trim(Arena *a){
-    Region *r = a->end->next;
-    while (r) {
-        Region *r0 = r;
-        r = r->next;
-        free_region(r0);
+#ifdef ARENA_FREE_ASYNC
+#include <pthread.h>
+
+// Lists of regions waiting for the reclaimer. The first region of every list holds the link to the
+// next list in data[0] and the backend of its arena in data[1].
+static Region *arena_free_async_stack = NULL;
+static size_t arena_free_async_pushed = 0;    // lists pushed so far
+static size_t arena_free_async_reclaimed = 0; // lists freed so far, only written under the lock
+static int arena_free_async_started = 0;
+static pthread_mutex_t arena_free_async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t arena_free_async_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t arena_free_async_done = PTHREAD_COND_INITIALIZER;
+
+static void *arena_free_async_thread(void *arg)
+{
+    (void) arg;
+    for (;;) {
+        pthread_mutex_lock(&arena_free_async_lock);
+        while (__atomic_load_n(&arena_free_async_stack, __ATOMIC_ACQUIRE) == NULL) {
+            pthread_cond_wait(&arena_free_async_wake, &arena_free_async_lock);
+        }
+        pthread_mutex_unlock(&arena_free_async_lock);
+
+        Region *list = __atomic_exchange_n(&arena_free_async_stack, NULL, __ATOMIC_ACQUIRE);
+        size_t reclaimed = 0;
+        while (list != NULL) {
+            Region *next_list = (Region*)list->data[0];
+            Arena a = {0};
+#ifdef ARENA_RUNTIME_BACKENDS
+            a.backend = (Arena_Backend*)list->data[1];
+#endif // ARENA_RUNTIME_BACKENDS
+            a.begin = list;
+            arena_free(&a);
+            list = next_list;
+            reclaimed += 1;
+        }
+#ifdef ARENA_REGION_CACHE
+        // The regions freed above land in the slots of this thread, which never exits and would
+        // keep them out of reach of the threads that allocate
+        arena_region_cache_release_slots();
+#endif // ARENA_REGION_CACHE
+
+        pthread_mutex_lock(&arena_free_async_lock);
+        arena_free_async_reclaimed += reclaimed;
+        pthread_cond_broadcast(&arena_free_async_done);
+        pthread_mutex_unlock(&arena_free_async_lock);
     }
-    a->end->next = NULL;
+    return NULL;
+}
+
+void arena_free_async(Arena *a)
+{
+    Region *list = a->begin;
+    if (list != NULL && (list->flags & ARENA_REGION_BORROWED)) {
+        // The buffer belongs to the caller, who may reuse it right away, so don't leave it in the list
+        list = list->next;
+        a->begin->next = NULL;
+    }
+    a->begin = NULL;
+    a->end = NULL;
+    if (list == NULL) return;
+    if (list->capacity < 2) {
+        // No room for the links
+        Arena tmp = *a;
+        tmp.begin = list;
+        arena_free(&tmp);
+        return;
+    }
+
+#ifdef ARENA_RUNTIME_BACKENDS
+    list->data[1] = (uintptr_t)a->backend;
+#endif // ARENA_RUNTIME_BACKENDS
+    Region *top = __atomic_load_n(&arena_free_async_stack, __ATOMIC_RELAXED);
+    do {
+        list->data[0] = (uintptr_t)top;
+    } while (!__atomic_compare_exchange_n(&arena_free_async_stack, &top, list, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    pthread_mutex_lock(&arena_free_async_lock);
+    arena_free_async_pushed += 1;
+    if (!arena_free_async_started) {
+        pthread_t thread;
+        int ret = pthread_create(&thread, NULL, arena_free_async_thread, NULL);
+        ARENA_ASSERT(ret == 0);
+        (void) ret;
+        pthread_detach(thread);
+        arena_free_async_started = 1;
+    }
+    pthread_cond_signal(&arena_free_async_wake);
+    pthread_mutex_unlock(&arena_free_async_lock);
+}
+
+void arena_free_async_flush(void)
+{
+    pthread_mutex_lock(&arena_free_async_lock);
+    size_t target = arena_free_async_pushed;
+    while (arena_free_async_reclaimed < target) {
+        pthread_cond_wait(&arena_free_async_done, &arena_free_async_lock);
+    }
+    pthread_mutex_unlock(&arena_free_async_lock);
+}
+#endif // ARENA_FREE_ASYNC
+
+#ifdef ARENA_EPOCH
+#ifdef __unix__
+#include <sched.h>
+#endif // __unix__
+
+size_t arena_epoch_enter(Arena_Epoch *e)
+{
+    for (;;) {
+        size_t epoch = __atomic_load_n(&e->epoch, __ATOMIC_SEQ_CST);
+        size_t *readers = &e->readers[epoch%ARENA_EPOCH_SLOTS].count;
+        __atomic_fetch_add(readers, 1, __ATOMIC_SEQ_CST);
+        // If the epoch is still current the writer can't be reusing its arena, since it only does
+        // that after publishing ARENA_EPOCH_SLOTS - 1 newer ones and checking the readers after that.
+        if (__atomic_load_n(&e->epoch, __ATOMIC_SEQ_CST) == epoch) return epoch;
+        __atomic_fetch_sub(readers, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+void *arena_epoch_root(Arena_Epoch *e, size_t epoch)
+{
+    return e->roots[epoch%ARENA_EPOCH_SLOTS];
+}
+
+void arena_epoch_leave(Arena_Epoch *e, size_t epoch)
+{
+    __atomic_fetch_sub(&e->readers[epoch%ARENA_EPOCH_SLOTS].count, 1, __ATOMIC_SEQ_CST);
+}
+
+Arena *arena_epoch_try_begin(Arena_Epoch *e)
+{
+    ARENA_ASSERT((uintptr_t)e%ARENA_CACHE_LINE_SIZE == 0);
+    size_t slot = (__atomic_load_n(&e->epoch, __ATOMIC_RELAXED) + 1)%ARENA_EPOCH_SLOTS;
+    if (__atomic_load_n(&e->readers[slot].count, __ATOMIC_SEQ_CST) != 0) return NULL;
+    arena_reset(&e->arenas[slot]);
+    e->roots[slot] = NULL;
+    return &e->arenas[slot];
+}
+
+Arena *arena_epoch_begin(Arena_Epoch *e)
+{
+    Arena *a;
+    while ((a = arena_epoch_try_begin(e)) == NULL) {
+#ifdef __unix__
+        sched_yield();
+#endif // __unix__
+    }
+    return a;
+}
+
+void arena_epoch_publish(Arena_Epoch *e, void *root)
+{
+    size_t epoch = __atomic_load_n(&e->epoch, __ATOMIC_RELAXED) + 1;
+    e->roots[epoch%ARENA_EPOCH_SLOTS] = root;
+    __atomic_store_n(&e->epoch, epoch, __ATOMIC_SEQ_CST);
+}
+
+void arena_epoch_free(Arena_Epoch *e)
+{
+    for (size_t i = 0; i < ARENA_EPOCH_SLOTS; ++i) {
+        arena_free(&e->arenas[i]);
+        e->roots[i] = NULL;
+    }
+}
+#endif // ARENA_EPOCH
+
+#ifdef ARENA_QUEUE
+// The first words of every producer region hold the number of messages in it that are not released
+// yet, the producer that owns it and the link of Arena_Producer.returned. The count starts at
+// ARENA_QUEUE_BIAS so it can't hit zero while the producer still allocates from the region. When the
+// producer moves on it takes away the part of the bias that no message accounts for, and whoever
+// brings the count to zero hands the region back.
+#define ARENA_QUEUE_REFS 0
+#define ARENA_QUEUE_OWNER 1
+#define ARENA_QUEUE_LINK 2
+#define ARENA_QUEUE_HEADER_WORDS 3
+#define ARENA_QUEUE_BIAS (UINTPTR_MAX/2)
+
+void arena_queue_init(Arena_Queue *q)
+{
+    q->stub.next = NULL;
+    q->stub.region = NULL;
+    q->stub.size = 0;
+    q->head = &q->stub;
+    q->tail = &q->stub;
+}
+
+void arena_producer_init(Arena_Producer *p, Arena_Queue *q)
+{
+    p->queue = q;
+    p->region = NULL;
+    p->messages = 0;
+    p->returned = NULL;
+    p->spare = NULL;
+}
+
+static void arena_queue_recycle(Region *r)
+{
+    Arena_Producer *owner = (Arena_Producer*)r->data[ARENA_QUEUE_OWNER];
+    Region *top = __atomic_load_n(&owner->returned, __ATOMIC_RELAXED);
+    do {
+        r->data[ARENA_QUEUE_LINK] = (uintptr_t)top;
+    } while (!__atomic_compare_exchange_n(&owner->returned, &top, r, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static void arena_queue_seal(Arena_Producer *p)
+{
+    Region *r = p->region;
+    uintptr_t unused = ARENA_QUEUE_BIAS - p->messages;
+    p->region = NULL;
+    p->messages = 0;
+    if (__atomic_sub_fetch(&r->data[ARENA_QUEUE_REFS], unused, __ATOMIC_ACQ_REL) == 0) {
+        arena_queue_recycle(r);
+    }
+}
+
+static Region *arena_queue_producer_region(Arena_Producer *p, size_t size)
+{
+    size_t capacity = ARENA_QUEUE_HEADER_WORDS + size;
+    if (capacity < ARENA_REGION_DEFAULT_CAPACITY) capacity = ARENA_REGION_DEFAULT_CAPACITY;
+
+    Region *returned = __atomic_exchange_n(&p->returned, NULL, __ATOMIC_ACQUIRE);
+    while (returned != NULL) {
+        Region *next = (Region*)returned->data[ARENA_QUEUE_LINK];
+        returned->next = p->spare;
+        p->spare = returned;
+        returned = next;
+    }
+
+    Region *r = NULL;
+    for (Region **it = &p->spare; *it != NULL; it = &(*it)->next) {
+        if ((*it)->capacity >= ARENA_QUEUE_HEADER_WORDS + size) {
+            r = *it;
+            *it = r->next;
+            break;
+        }
+    }
+    if (r == NULL) r = new_region(capacity);
+    if (r == NULL) return NULL;
+
+    r->next = NULL;
+    r->count = ARENA_QUEUE_HEADER_WORDS;
+    r->data[ARENA_QUEUE_REFS] = ARENA_QUEUE_BIAS;
+    r->data[ARENA_QUEUE_OWNER] = (uintptr_t)p;
+    r->data[ARENA_QUEUE_LINK] = 0;
+    p->region = r;
+    return r;
+}
+
+void *arena_queue_alloc(Arena_Producer *p, size_t size_bytes)
+{
+    size_t size = (sizeof(Arena_Message) + size_bytes + sizeof(uintptr_t) - 1)/sizeof(uintptr_t);
+    Region *r = p->region;
+    if (r == NULL || r->count + size > r->capacity) {
+        if (r != NULL) arena_queue_seal(p);
+        r = arena_queue_producer_region(p, size);
+        if (r == NULL) return NULL;
+    }
+
+    Arena_Message *m = (Arena_Message*)&r->data[r->count];
+    r->count += size;
+    p->messages += 1;
+    m->next = NULL;
+    m->region = r;
+    m->size = size_bytes;
+    return m + 1;
+}
+
+void arena_queue_push(Arena_Producer *p, void *message)
+{
+    Arena_Message *m = (Arena_Message*)message - 1;
+    m->next = NULL;
+    Arena_Message *prev = __atomic_exchange_n(&p->queue->head, m, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, m, __ATOMIC_RELEASE);
+}
+
+// Dmitry Vyukov's intrusive MPSC queue, with a stub node that keeps the queue from ever being empty
+static void arena_queue_push_stub(Arena_Queue *q)
+{
+    q->stub.next = NULL;
+    Arena_Message *prev = __atomic_exchange_n(&q->head, &q->stub, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, &q->stub, __ATOMIC_RELEASE);
+}
+
+void *arena_queue_pop(Arena_Queue *q, size_t *size_bytes)
+{
+    Arena_Message *tail = q->tail;
+    Arena_Message *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (tail == &q->stub) {
+        if (next == NULL) return NULL;
+        q->tail = next;
+        tail = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+    if (next == NULL) {
+        // The tail is the last message, put the stub behind it so it can be taken out
+        if (tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE)) return NULL;
+        arena_queue_push_stub(q);
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+        if (next == NULL) return NULL;
+    }
+    q->tail = next;
+    if (size_bytes) *size_bytes = tail->size;
+    return tail + 1;
+}
+
+void arena_queue_release(void *message)
+{
+    Region *r = ((Arena_Message*)message - 1)->region;
+    if (__atomic_sub_fetch(&r->data[ARENA_QUEUE_REFS], 1, __ATOMIC_ACQ_REL) == 0) {
+        arena_queue_recycle(r);
+    }
+}
+
+void arena_producer_free(Arena_Producer *p)
+{
+    if (p->region != NULL) arena_queue_seal(p);
+    Region *r = __atomic_exchange_n(&p->returned, NULL, __ATOMIC_ACQUIRE);
+    while (r != NULL) {
+        Region *next = (Region*)r->data[ARENA_QUEUE_LINK];
+        free_region(r);
+        r = next;
+    }
+    while (p->spare != NULL) {
+        Region *next = p->spare->next;
+        free_region(p->spare);
+        p->spare = next;
+    }
+}
+#endif // ARENA_QUEUE
+
+// Processes the data a word at a time with multiplications, which pipelines well, and mixes the
+// result with the finalizer of MurmurHash3
+uint64_t arena_hash_bytes(const void *data, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char*)data;
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ (size*0xC2B2AE3D27D4EB4Full);
+    for (; size >= 8; size -= 8, bytes += 8) {
+        uint64_t w = 0;
+        for (int i = 0; i < 8; ++i) w |= (uint64_t)bytes[i] << (8*i);
+        h = (h ^ (w*0x87C37B91114253D5ull))*0x9E3779B97F4A7C15ull;
+        h ^= h >> 29;
+    }
+    uint64_t w = 0;
+    for (size_t i = 0; i < size; ++i) w |= (uint64_t)bytes[i] << (8*i);
+    h = (h ^ (w*0x87C37B91114253D5ull))*0x9E3779B97F4A7C15ull;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+#if defined(__SSE2__) && !defined(ARENA_HM_NO_SIMD)
+#include <emmintrin.h>
+#endif
+
+#define ARENA_HM_EMPTY 0x80 // control byte of a free slot, full ones hold 7 bits of the hash
+#define ARENA_HM_H2(hash) ((unsigned char)((hash) & 0x7F))
+#define ARENA_HM_H1(hash) ((size_t)((hash) >> 7))
+
+// Bit i is set if byte i of the group is `b`
+static unsigned arena_hm_group_match(const unsigned char *group, unsigned char b)
+{
+#if defined(__SSE2__) && !defined(ARENA_HM_NO_SIMD)
+    __m128i g = _mm_loadu_si128((const __m128i*)group);
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)b)));
+#else
+    unsigned mask = 0;
+    for (unsigned i = 0; i < ARENA_HM_GROUP_SIZE; ++i) mask |= (unsigned)(group[i] == b) << i;
+    return mask;
+#endif
+}
+
+static unsigned arena_hm_ctz(unsigned mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctz(mask);
+#else
+    unsigned n = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        n += 1;
+    }
+    return n;
+#endif
+}
+
+// The first free slot in the probe sequence of `hash`. There always is one since the table is
+// never more than 7/8 full.
+static size_t arena_hm_free_slot(const unsigned char *ctrl, size_t capacity, uint64_t hash)
+{
+    size_t mask = capacity/ARENA_HM_GROUP_SIZE - 1;
+    size_t group = ARENA_HM_H1(hash) & mask;
+    for (size_t step = 1;; ++step) {
+        unsigned empty = arena_hm_group_match(ctrl + group*ARENA_HM_GROUP_SIZE, ARENA_HM_EMPTY);
+        if (empty) return group*ARENA_HM_GROUP_SIZE + arena_hm_ctz(empty);
+        // Triangular numbers visit every group of a power of two sized table
+        group = (group + step) & mask;
+    }
+}
+
+// Whether [p, p + size_bytes) is the last allocation of the arena, which arena_realloc() extends in place
+static int arena_is_last_alloc(Arena *a, const void *p, size_t size_bytes)
+{
+    Region *r = a->end;
+    size_t words = (size_bytes + sizeof(uintptr_t) - 1)/sizeof(uintptr_t);
+    return p != NULL && r != NULL && (const uintptr_t*)p >= r->data && (const uintptr_t*)p + words == &r->data[r->count];
+}
+
+// Whether arena_realloc() of the block at `p` may move its region with mremap() (see
+// ARENA_MREMAP_MAYMOVE), which unmaps the old block instead of leaving a copy of it behind
+static int arena_realloc_may_unmap(Arena *a, const void *p)
+{
+#ifdef ARENA_MREMAP_MAYMOVE
+    return p != NULL && a->end != NULL && p == (const void*)a->end->data;
+#else
+    (void) a;
+    (void) p;
+    return 0;
+#endif // ARENA_MREMAP_MAYMOVE
+}
+
+// The table grows into a block of the old size plus the new size, so arena_realloc() can extend
+// it in place. The new table is built behind the old one and slid down over it afterwards, giving
+// back the old size to the arena if the block is still the last allocation of it.
+static int arena_hm_grow(Arena *a, void **items, size_t *capacity, size_t item_size, const Arena_HM_Ops *ops, size_t key_size)
+{
+    size_t old_capacity = *capacity;
+    size_t new_capacity = old_capacity ? old_capacity*2 : ARENA_HM_GROUP_SIZE;
+    size_t old_size = old_capacity*(item_size + 1);
+    size_t new_size = new_capacity*(item_size + 1);
+    size_t offset = (old_size + sizeof(uintptr_t) - 1)/sizeof(uintptr_t)*sizeof(uintptr_t);
+
+    char *block = (char*)arena_realloc(a, *items, old_size, offset + new_size);
+    if (block == NULL) return 0;
+
+    const char *old_items = block;
+    const unsigned char *old_ctrl = (const unsigned char*)block + old_capacity*item_size;
+    char *new_items = block + offset;
+    unsigned char *new_ctrl = (unsigned char*)new_items + new_capacity*item_size;
+    for (size_t i = 0; i < new_capacity; ++i) new_ctrl[i] = ARENA_HM_EMPTY;
+
+    for (size_t i = 0; i < old_capacity; ++i) {
+        if (old_ctrl[i] == ARENA_HM_EMPTY) continue;
+        const char *item = old_items + i*item_size;
+        uint64_t hash = ops->hash(item, key_size);
+        size_t slot = arena_hm_free_slot(new_ctrl, new_capacity, hash);
+        new_ctrl[slot] = ARENA_HM_H2(hash);
+        arena_memcpy(new_items + slot*item_size, item, item_size);
+    }
+
+    // Overlapping, but moving down byte by byte from the front is fine
+    for (size_t i = 0; i < new_size; ++i) block[i] = new_items[i];
+
+    if (offset > 0 && arena_is_last_alloc(a, block, offset + new_size)) {
+        a->end->count -= offset/sizeof(uintptr_t);
+    }
+
+    *items = block;
+    *capacity = new_capacity;
+    return 1;
+}
+
+void *arena_hm_probe(Arena *a, void **items, size_t *count, size_t *capacity, size_t item_size,
+                     const Arena_HM_Ops *ops, const void *key, size_t key_size, uint64_t hash, int *inserted)
+{
+    if (inserted) *inserted = 0;
+
+    if (*capacity > 0) {
+        char *base = (char*)*items;
+        const unsigned char *ctrl = (const unsigned char*)base + *capacity*item_size;
+        size_t mask = *capacity/ARENA_HM_GROUP_SIZE - 1;
+        size_t group = ARENA_HM_H1(hash) & mask;
+        for (size_t step = 1;; ++step) {
+            const unsigned char *g = ctrl + group*ARENA_HM_GROUP_SIZE;
+            for (unsigned match = arena_hm_group_match(g, ARENA_HM_H2(hash)); match; match &= match - 1) {
+                char *item = base + (group*ARENA_HM_GROUP_SIZE + arena_hm_ctz(match))*item_size;
+                if (ops->eq(item, key, key_size)) return item;
+            }
+            if (arena_hm_group_match(g, ARENA_HM_EMPTY)) break;
+            group = (group + step) & mask;
+        }
+    }
+
+    if (inserted == NULL) return NULL;
+    if ((*count + 1)*8 > *capacity*7) {
+        if (!arena_hm_grow(a, items, capacity, item_size, ops, key_size)) return NULL;
+    }
+    char *base = (char*)*items;
+    unsigned char *ctrl = (unsigned char*)base + *capacity*item_size;
+    size_t slot = arena_hm_free_slot(ctrl, *capacity, hash);
+    ctrl[slot] = ARENA_HM_H2(hash);
+    *count += 1;
+    *inserted = 1;
+    return base + slot*item_size;
+}
+
+// Give back the slot arena_hm_probe() just took for `item`. Only valid before anything else is
+// inserted, since the probe sequences of later keys may go through the slot.
+static void arena_hm_unprobe(void *items, size_t *count, size_t capacity, size_t item_size, void *item)
+{
+    unsigned char *ctrl = (unsigned char*)items + capacity*item_size;
+    ctrl[((char*)item - (char*)items)/item_size] = ARENA_HM_EMPTY;
+    *count -= 1;
+}
+
+static uint64_t arena_hm_bytes_hash(const void *item, size_t key_size)
+{
+    return arena_hash_bytes(item, key_size);
+}
+
+static int arena_hm_bytes_eq(const void *item, const void *key, size_t key_size)
+{
+    const unsigned char *x = (const unsigned char*)item;
+    const unsigned char *y = (const unsigned char*)key;
+    for (size_t i = 0; i < key_size; ++i) {
+        if (x[i] != y[i]) return 0;
+    }
+    return 1;
+}
+
+static const Arena_HM_Ops arena_hm_bytes_ops = {arena_hm_bytes_hash, arena_hm_bytes_eq};
+
+void *arena_hm_put_bytes(Arena *a, void **items, size_t *count, size_t *capacity, size_t item_size, const void *key, size_t key_size)
+{
+    int inserted;
+    char *item = (char*)arena_hm_probe(a, items, count, capacity, item_size, &arena_hm_bytes_ops,
+                                       key, key_size, arena_hash_bytes(key, key_size), &inserted);
+    if (item != NULL && inserted) {
+        for (size_t i = 0; i < item_size; ++i) item[i] = 0;
+        arena_memcpy(item, key, key_size);
+    }
+    return item;
+}
+
+void *arena_hm_get_bytes(void *items, size_t capacity, size_t item_size, const void *key, size_t key_size)
+{
+    size_t count = 0;
+    return arena_hm_probe(NULL, &items, &count, &capacity, item_size, &arena_hm_bytes_ops,
+                          key, key_size, arena_hash_bytes(key, key_size), NULL);
+}
+
+// Whether [p, p + size) was allocated before the mark, i.e. survives rewinding to it
+static int arena_allocated_before(Arena *a, Arena_Mark m, const void *p, size_t size)
+{
+    uintptr_t begin = (uintptr_t)p;
+    uintptr_t end = begin + size;
+    for (Region *r = a->begin; r != NULL && m.region != NULL; r = r->next) {
+        uintptr_t data = (uintptr_t)r->data;
+        size_t count = r == m.region ? m.count : r->count;
+        if (data <= begin && end <= data + sizeof(uintptr_t)*count) return 1;
+        if (r == m.region) break;
+    }
+    return 0;
+}
+
+void arena_hm_rewind_bytes(Arena *a, void **items, size_t *count, size_t *capacity, size_t item_size, Arena_Mark m)
+{
+    if (*items != NULL && !arena_allocated_before(a, m, *items, *capacity*(item_size + 1))) {
+        *items = NULL;
+        *count = 0;
+        *capacity = 0;
+    }
+    arena_rewind(a, m);
+}
+
+static uint64_t arena_intern_hash(const void *item, size_t key_size)
+{
+    (void) key_size;
+    return ((const Arena_Interned*)item)->hash;
+}
+
+static int arena_intern_eq(const void *item, const void *key, size_t key_size)
+{
+    (void) key_size;
+    const Arena_Interned *x = (const Arena_Interned*)item;
+    const Arena_Interned *y = (const Arena_Interned*)key;
+    if (x->hash != y->hash || x->len != y->len) return 0;
+    for (size_t i = 0; i < x->len; ++i) {
+        if (x->str[i] != y->str[i]) return 0;
+    }
+    return 1;
+}
+
+static const Arena_HM_Ops arena_intern_ops = {arena_intern_hash, arena_intern_eq};
+
+const char *arena_intern(Arena *a, Arena_Intern_Table *t, const char *str, size_t len)
+{
+    Arena_Interned key = {str, len, arena_hash_bytes(str, len)};
+    Arena_Interned *old_items = t->items;
+    size_t old_size = t->capacity*(sizeof(*t->items) + 1);
+    int old_may_unmap = arena_realloc_may_unmap(a, old_items);
+    int inserted;
+    Arena_Interned *item = (Arena_Interned*)arena_hm_probe(a, (void**)&t->items, &t->count, &t->capacity, sizeof(*t->items),
+                                                           &arena_intern_ops, &key, sizeof(key), key.hash, &inserted);
+    if (item == NULL) return NULL;
+    if (!inserted) return item->str;
+
+    // When the table had to be copied to grow, what's left behind is ours to put strings into
+    if (old_items != NULL && t->items != old_items && !old_may_unmap && old_size > t->chunk_left) {
+        t->chunk = (char*)old_items;
+        t->chunk_left = old_size;
+    }
+
+    if (len + 1 > t->chunk_left) {
+        // A chunk allocated after the table would keep the table from growing in place, leaving
+        // a dead copy behind every time. So while the table is the last allocation of the arena,
+        // it is extended and moved up instead, and the chunk goes in front of it. The chunks grow
+        // with the table, which keeps the moving amortized O(1) per byte interned.
+        size_t table_size = t->capacity*(sizeof(*t->items) + 1);
+        size_t chunk_size = table_size/4 > ARENA_INTERN_CHUNK_SIZE ? table_size/4 : ARENA_INTERN_CHUNK_SIZE;
+        if (chunk_size < len + 1) chunk_size = len + 1;
+        chunk_size = (chunk_size + sizeof(uintptr_t) - 1)/sizeof(uintptr_t)*sizeof(uintptr_t);
+        char *chunk = NULL;
+        if (arena_is_last_alloc(a, t->items, table_size)) {
+            int may_unmap = arena_realloc_may_unmap(a, t->items);
+            char *block = (char*)arena_realloc(a, t->items, table_size, chunk_size + table_size);
+            if (block == (char*)t->items || (block != NULL && may_unmap)) {
+                for (size_t i = table_size; i-- > 0;) block[chunk_size + i] = block[i];
+                chunk = block;
+            } else if (block != NULL) {
+                // The region was full and the table got copied into a new one (not moved, the old
+                // one is still there). Then the old table is the chunk and the space asked for
+                // after the copy goes back.
+                a->end->count -= chunk_size/sizeof(uintptr_t);
+                chunk = (char*)t->items;
+                chunk_size = table_size;
+            }
+            if (block != NULL) {
+                char *table = block == chunk ? block + chunk_size : block;
+                item = (Arena_Interned*)(table + ((char*)item - (char*)t->items));
+                t->items = (Arena_Interned*)table;
+            }
+        } else {
+            chunk = (char*)arena_alloc(a, chunk_size);
+        }
+        if (chunk != NULL) {
+            t->chunk = chunk;
+            t->chunk_left = chunk_size;
+        }
+    }
+
+    char *copy = NULL;
+    if (len + 1 <= t->chunk_left) {
+        copy = t->chunk;
+        t->chunk += len + 1;
+        t->chunk_left -= len + 1;
+    }
+    if (copy == NULL) {
+        arena_hm_unprobe(t->items, &t->count, t->capacity, sizeof(*t->items), item);
+        return NULL;
+    }
+    arena_memcpy(copy, str, len);
+    copy[len] = '\0';
+
+    item->str = copy;
+    item->len = len;
+    item->hash = key.hash;
+    return copy;
+}
+
+const char *arena_intern_cstr(Arena *a, Arena_Intern_Table *t, const char *cstr)
+{
+    return arena_intern(a, t, cstr, arena_strlen(cstr));
+}
+
+void arena_prefault(Arena *a, size_t size_bytes)
+{
+    size_t size = (size_bytes + sizeof(uintptr_t) - 1)/sizeof(uintptr_t);
+
+#if defined(ARENA_STATS) && defined(__unix__)
+    struct rusage usage_before;
+    getrusage(RUSAGE_SELF, &usage_before);
+#endif
+
+    if (a->end == NULL) {
+        ARENA_ASSERT(a->begin == NULL);
+        a->end = arena_new_region(a, size);
+        a->begin = a->end;
+    }
+
+    // Walk the free space in the same order arena_alloc() is going to use it
+    Region *r = a->end;
+    size_t begin = r ? r->count : 0;
+    while (r != NULL && size > 0) {
+        if (begin == r->capacity) {
+            if (r->next != NULL) {
+                r = r->next;
+                begin = r->count;
+            } else if (!(r->flags & ARENA_REGION_GROWABLE) || !arena_grow_region(a, r, r->capacity + size)) {
+                // NULL for fixed arenas, which can't get any more memory to prefault
+                r->next = arena_new_region(a, size);
+                r = r->next;
+                begin = 0;
+            }
+            continue;
+        }
+
+        size_t n = r->capacity - begin;
+        if (n > size) n = size;
+        arena_prefault_pages(&r->data[begin], sizeof(uintptr_t)*n);
+        begin += n;
+        size -= n;
+    }
+
+#if defined(ARENA_STATS) && defined(__unix__)
+    struct rusage usage_after;
+    getrusage(RUSAGE_SELF, &usage_after);
+    ARENA_STATS_ADD(prefault_minor_faults, usage_after.ru_minflt - usage_before.ru_minflt);
+    ARENA_STATS_ADD(prefault_major_faults, usage_after.ru_majflt - usage_before.ru_majflt);
+#endif
+}
+
+void arena_trim(Arena *a){
+    if (a->end == NULL) return;
+    Region *r = a->end->next;
+    while (r) {
+        Region *r0 = r;
+        r = r->next;
+        arena_free_region(a, r0);
+    }
+    a->end->next = NULL;
+    arena_decommit_region(a, a->end);
+}
+
+void arena_init_buffer(Arena *a, void *buf, size_t size_bytes)
+{
+    ARENA_ASSERT(a->begin == NULL && a->end == NULL);
+    // The Region header has to be aligned like the data it holds
+    uintptr_t begin = ((uintptr_t)buf + sizeof(uintptr_t) - 1) & ~(uintptr_t)(sizeof(uintptr_t) - 1);
+    uintptr_t end = (uintptr_t)buf + size_bytes;
+    ARENA_ASSERT(end >= begin + sizeof(Region) && "buffer is too small for the Region header");
+
+    Region *r = (Region*)begin;
+    r->next = NULL;
+    r->count = 0;
+    r->capacity = (end - begin - sizeof(Region))/sizeof(uintptr_t);
+    r->flags = ARENA_REGION_BORROWED;
+    a->begin = r;
+    a->end = r;
+}
+
+void arena_splice(Arena *dst, Arena *src)
+{
+    ARENA_ASSERT(dst != src);
+#ifdef ARENA_RUNTIME_BACKENDS
+    ARENA_ASSERT(dst->backend == src->backend && "splicing arenas with different backends");
+#endif // ARENA_RUNTIME_BACKENDS
+    if (src->end == NULL) return;
+
+    Region *first = src->begin;
+    Region *last = src->end;
+    Region *spare = last->next;
+
+    if (dst->end == NULL) {
+        ARENA_ASSERT(dst->begin == NULL);
+        last->next = NULL;
+        dst->begin = first;
+    } else {
+        last->next = dst->end->next;
+        dst->end->next = first;
+    }
+    dst->end = last;
+
+    src->begin = spare;
+    src->end = spare;
+}
+
+#ifdef ARENA_SCRATCH
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#define ARENA_SCRATCH_PTHREAD
+#endif
+
+static ARENA_THREAD_LOCAL Arena arena_scratch_arenas[ARENA_SCRATCH_COUNT];
+
+#ifdef ARENA_SCRATCH_PTHREAD
+static ARENA_THREAD_LOCAL int arena_scratch_thread_registered;
+static pthread_key_t arena_scratch_thread_key;
+static pthread_once_t arena_scratch_thread_once = PTHREAD_ONCE_INIT;
+
+static void arena_scratch_thread_exit(void *arg)
+{
+    (void) arg;
+    arena_scratch_free();
+}
+
+static void arena_scratch_thread_init(void)
+{
+    pthread_key_create(&arena_scratch_thread_key, arena_scratch_thread_exit);
+}
+#endif // ARENA_SCRATCH_PTHREAD
+
+Arena_Scratch arena_scratch_begin(Arena **conflicts, size_t conflicts_count)
+{
+#ifdef ARENA_SCRATCH_PTHREAD
+    if (!arena_scratch_thread_registered) {
+        // Only to get arena_scratch_thread_exit() called when the thread exits
+        pthread_once(&arena_scratch_thread_once, arena_scratch_thread_init);
+        pthread_setspecific(arena_scratch_thread_key, &arena_scratch_thread_registered);
+        arena_scratch_thread_registered = 1;
+    }
+#endif // ARENA_SCRATCH_PTHREAD
+    for (size_t i = 0; i < ARENA_SCRATCH_COUNT; ++i) {
+        Arena *a = &arena_scratch_arenas[i];
+        int conflict = 0;
+        for (size_t j = 0; j < conflicts_count && !conflict; ++j) {
+            conflict = conflicts[j] == a;
+        }
+        if (!conflict) {
+            Arena_Scratch scratch;
+            scratch.arena = a;
+            scratch.mark = arena_snapshot(a);
+            return scratch;
+        }
+    }
+    ARENA_ASSERT(0 && "all the scratch arenas conflict, increase ARENA_SCRATCH_COUNT");
+    Arena_Scratch scratch = {0};
+    return scratch;
+}
+
+void arena_scratch_end(Arena_Scratch scratch)
+{
+    arena_rewind(scratch.arena, scratch.mark);
+}
+
+void arena_scratch_free(void)
+{
+    for (size_t i = 0; i < ARENA_SCRATCH_COUNT; ++i) {
+        arena_free(&arena_scratch_arenas[i]);
+    }
+}
+#endif // ARENA_SCRATCH
+
+#ifdef ARENA_SHARED
+void *arena_shared_alloc(Arena_Shared *s, size_t size_bytes)
+{
+    size_t size = (size_bytes + sizeof(uintptr_t) - 1)/sizeof(uintptr_t);
+    Arena *a = &s->arena;
+
+    for (;;) {
+        Region *r = __atomic_load_n(&a->end, __ATOMIC_ACQUIRE);
+        if (r != NULL) {
+            size_t count = __atomic_load_n(&r->count, __ATOMIC_RELAXED);
+            while (count + size <= r->capacity) {
+                if (__atomic_compare_exchange_n(&r->count, &count, count + size, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                    return &r->data[count];
+                }
+            }
+        }
+
+        // The region is full. Whoever gets the lock first moves the arena to the next region, the
+        // rest find that a->end has changed already and just retry.
+        pthread_mutex_lock(&s->lock);
+        if (__atomic_load_n(&a->end, __ATOMIC_RELAXED) == r) {
+            Region *next = NULL;
+            if (r != NULL && r->next != NULL && size <= r->next->capacity) {
+                // Left over by arena_shared_reset()
+                next = r->next;
+            } else {
+                next = arena_new_region(a, size);
+                if (next != NULL && r != NULL) {
+                    next->next = r->next;
+                    r->next = next;
+                }
+            }
+            if (next == NULL) {
+                pthread_mutex_unlock(&s->lock);
+                return NULL;
+            }
+            if (a->begin == NULL) a->begin = next;
+            __atomic_store_n(&a->end, next, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+void arena_shared_reset(Arena_Shared *s)
+{
+    arena_reset(&s->arena);
+}
+
+void arena_shared_free(Arena_Shared *s)
+{
+    arena_free(&s->arena);
+}
+#endif // ARENA_SHARED
+
+#ifdef ARENA_PERCPU
+#ifdef __linux__
+// Declared by <sched.h> only with _GNU_SOURCE. Goes through the vDSO, so it is about as cheap as a
+// function call.
+extern int sched_getcpu(void);
+#endif // __linux__
+
+static size_t arena_percpu_stripe(void)
+{
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    if (cpu >= 0) return (size_t)cpu%ARENA_PERCPU_STRIPES;
+#endif // __linux__
+    // Without the CPU number every thread sticks to a stripe of its own, assigned round-robin
+    static size_t next_stripe = 0;
+    static ARENA_THREAD_LOCAL size_t stripe = (size_t)-1;
+    if (stripe == (size_t)-1) stripe = __atomic_fetch_add(&next_stripe, 1, __ATOMIC_RELAXED)%ARENA_PERCPU_STRIPES;
+    return stripe;
+}
+
+void arena_percpu_init(Arena_PerCPU *p)
+{
+    ARENA_ASSERT((uintptr_t)p%ARENA_CACHE_LINE_SIZE == 0);
+    for (size_t i = 0; i < ARENA_PERCPU_STRIPES; ++i) {
+        Arena arena = {0};
+        p->stripes[i].shared.arena = arena;
+        pthread_mutex_init(&p->stripes[i].shared.lock, NULL);
+    }
+}
+
+void *arena_percpu_alloc(Arena_PerCPU *p, size_t size_bytes)
+{
+    // The thread may migrate right after picking the stripe, which is fine since the stripes are
+    // thread safe anyway, it just got a bit slower allocation this time.
+    return arena_shared_alloc(&p->stripes[arena_percpu_stripe()].shared, size_bytes);
+}
+
+void arena_percpu_reset(Arena_PerCPU *p)
+{
+    for (size_t i = 0; i < ARENA_PERCPU_STRIPES; ++i) arena_shared_reset(&p->stripes[i].shared);
+}
+
+void arena_percpu_free(Arena_PerCPU *p)
+{
+    for (size_t i = 0; i < ARENA_PERCPU_STRIPES; ++i) arena_shared_free(&p->stripes[i].shared);
+}
+#endif // ARENA_PERCPU
+
+#ifndef ARENA_NOSTDIO
+#include <errno.h>
+
+typedef struct {
+    char magic[8];         // "ARENASN"
+    uint32_t version;      // ARENA_SNAPSHOT_VERSION
+    uint32_t word_size;    // sizeof(uintptr_t) of the process that saved the snapshot
+    uint64_t data_size;    // bytes of data following the header
+    uint64_t relocs_count; // (slot, pointer) pairs following the data
+    uint64_t root;         // pointer encoded like in the relocation pairs
+} Arena_Snapshot_Header;
+
+static const char arena_snapshot_magic[8] = "ARENASN";
+
+// Pointers are stored as offsets into the data of the snapshot plus one, 0 is NULL. The data is
+// the used part of every region concatenated. *hint and *hint_offset remember the region of the
+// previous lookup and where its data starts in the snapshot, since pointers tend to be close.
+static int arena_snapshot_encode(Arena *a, Region **hint, uint64_t *hint_offset, const void *p, uint64_t *encoded)
+{
+    if (p == NULL) {
+        *encoded = 0;
+        return 1;
+    }
+    uintptr_t u = (uintptr_t)p;
+    for (int pass = 0; pass < 2; ++pass) {
+        Region *r = pass == 0 ? *hint : a->begin;
+        uint64_t offset = pass == 0 ? *hint_offset : 0;
+        for (; r != NULL; r = r->next) {
+            uintptr_t begin = (uintptr_t)r->data;
+            if (begin <= u && u <= begin + sizeof(uintptr_t)*r->count) {
+                *hint = r;
+                *hint_offset = offset;
+                *encoded = offset + (u - begin) + 1;
+                return 1;
+            }
+            offset += sizeof(uintptr_t)*r->count;
+        }
+    }
+    errno = EINVAL;
+    return 0;
+}
+
+int arena_save(Arena *a, const char *path, void *root, Arena_Relocs *relocs)
+{
+    Arena_Snapshot_Header header = {0};
+    arena_memcpy(header.magic, arena_snapshot_magic, sizeof(arena_snapshot_magic));
+    header.version = ARENA_SNAPSHOT_VERSION;
+    header.word_size = sizeof(uintptr_t);
+    for (Region *r = a->begin; r != NULL; r = r->next) {
+        header.data_size += sizeof(uintptr_t)*r->count;
+    }
+    header.relocs_count = relocs ? relocs->count : 0;
+    Region *hint = a->begin;
+    uint64_t hint_offset = 0;
+    if (!arena_snapshot_encode(a, &hint, &hint_offset, root, &header.root)) return 0;
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) return 0;
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    for (Region *r = a->begin; ok && r != NULL; r = r->next) {
+        ok = fwrite(r->data, sizeof(uintptr_t), r->count, f) == r->count;
+    }
+    for (size_t i = 0; ok && i < header.relocs_count; ++i) {
+        uint64_t pair[2];
+        ok = arena_snapshot_encode(a, &hint, &hint_offset, relocs->items[i], &pair[0])
+            && arena_snapshot_encode(a, &hint, &hint_offset, *relocs->items[i], &pair[1]);
+        ok = ok && pair[0] != 0 && fwrite(pair, sizeof(pair), 1, f) == 1;
+    }
+    int saved_errno = errno;
+    if (fclose(f) != 0) ok = 0;
+    if (!ok) {
+        remove(path);
+        errno = saved_errno;
+    }
+    return ok;
+}
+
+int arena_load(Arena *a, const char *path, void **root)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) return 0;
+
+    Arena_Snapshot_Header header;
+    int ok = fread(&header, sizeof(header), 1, f) == 1;
+    for (size_t i = 0; ok && i < sizeof(arena_snapshot_magic); ++i) {
+        ok = header.magic[i] == arena_snapshot_magic[i];
+    }
+    ok = ok && header.version == ARENA_SNAPSHOT_VERSION
+            && header.word_size == sizeof(uintptr_t)
+            && header.data_size%sizeof(uintptr_t) == 0
+            && header.root <= header.data_size + 1;
+
+    // The sizes in the header must add up to the size of the file before anything gets allocated
+    // for them, a corrupted data_size would ask the arena for any amount of memory otherwise
+    long file_size = -1;
+    if (ok && fseek(f, 0, SEEK_END) == 0) file_size = ftell(f);
+    ok = ok && file_size >= 0 && fseek(f, sizeof(header), SEEK_SET) == 0;
+    if (ok) {
+        uint64_t rest = (uint64_t)file_size - sizeof(header);
+        ok = header.data_size <= rest
+            && header.relocs_count == (rest - header.data_size)/(2*sizeof(uint64_t))
+            && (rest - header.data_size)%(2*sizeof(uint64_t)) == 0;
+    }
+    if (!ok) errno = EINVAL;
+
+    // Whatever fails from here on, the block goes away again
+    Arena_Mark mark = arena_snapshot(a);
+    char *data = NULL;
+    if (ok) {
+        // arena_alloc() wants at least one byte for an empty snapshot to still get a valid pointer
+        data = (char*)arena_alloc(a, header.data_size ? header.data_size : 1);
+        if (data == NULL) {
+            errno = ENOMEM;
+            ok = 0;
+        }
+    }
+    if (ok && fread(data, 1, header.data_size, f) != header.data_size) {
+        errno = EINVAL;
+        ok = 0;
+    }
+
+    uint64_t pairs[2*256];
+    for (uint64_t done = 0; ok && done < header.relocs_count;) {
+        size_t n = sizeof(pairs)/sizeof(pairs[0])/2;
+        if (n > header.relocs_count - done) n = header.relocs_count - done;
+        ok = fread(pairs, 2*sizeof(uint64_t), n, f) == n;
+        if (!ok) errno = EINVAL;
+        for (size_t i = 0; ok && i < n; ++i) {
+            uint64_t slot = pairs[2*i], ptr = pairs[2*i + 1];
+            ok = slot != 0 && slot - 1 + sizeof(void*) <= header.data_size && ptr <= header.data_size + 1;
+            if (!ok) {
+                errno = EINVAL;
+                break;
+            }
+            void *value = ptr ? data + ptr - 1 : NULL;
+            arena_memcpy(data + slot - 1, &value, sizeof(value));
+        }
+        done += n;
+    }
+    if (ok && root) *root = header.root ? data + header.root - 1 : NULL;
+    if (!ok && data != NULL) arena_rewind(a, mark);
+
+    int saved_errno = errno;
+    fclose(f);
+    errno = saved_errno;
+    return ok;
+}
+#endif // ARENA_NOSTDIO
+
+#ifdef ARENA_FILE
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif // __linux__
+
+// <unistd.h> leaves these out below POSIX.1-2008, e.g. in strict ISO C modes such as -std=c11
+#if !defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 200809L
+extern int ftruncate(int fd, off_t length);
+extern ssize_t pread(int fd, void *buf, size_t count, off_t offset);
+#endif
+
+static const char arena_file_magic[8] = "ARENAFL";
+
+static int arena_file_header_valid(const Arena_File_Header *h, off_t file_size)
+{
+    for (size_t i = 0; i < sizeof(arena_file_magic); ++i) {
+        if (h->magic[i] != arena_file_magic[i]) return 0;
+    }
+    return h->version == ARENA_FILE_VERSION
+        && h->word_size == sizeof(uintptr_t)
+        && h->size >= ARENA_FILE_HEADER_SIZE + sizeof(Region)
+        && (off_t)h->size <= file_size;
+}
+
+// The Region right after the header comes from the file too, so a corrupted one must not let
+// arena_alloc() write past the end of the mapping
+static int arena_file_region_valid(const Region *r, size_t size_bytes)
+{
+    size_t max_capacity = (size_bytes - ARENA_FILE_HEADER_SIZE - sizeof(Region))/sizeof(uintptr_t);
+    return r->next == NULL
+        && r->capacity <= max_capacity
+        && r->count <= r->capacity;
+}
+
+int arena_file_open(Arena_File *f, const char *path, size_t size_bytes, void *base)
+{
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return 0;
+    if (!arena_file_open_fd(f, fd, size_bytes, base)) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return 0;
+    }
+    return 1;
+}
+
+int arena_file_open_fd(Arena_File *f, int fd, size_t size_bytes, void *base)
+{
+    ARENA_ASSERT(sizeof(Arena_File_Header) <= ARENA_FILE_HEADER_SIZE);
+
+    int anywhere = base == ARENA_FILE_ANYWHERE;
+    if (anywhere) base = NULL;
+
+    Arena_File_Header header;
+    struct stat st;
+    int ok = fstat(fd, &st) == 0;
+    int fresh = ok && st.st_size == 0;
+    if (ok && fresh) {
+        size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+        size_bytes = (size_bytes + page_size - 1)/page_size*page_size;
+        if (size_bytes < ARENA_FILE_HEADER_SIZE + sizeof(Region)) size_bytes = page_size;
+        ok = ftruncate(fd, (off_t)size_bytes) == 0;
+    } else if (ok) {
+        ssize_t n = pread(fd, &header, sizeof(header), 0);
+        ok = n >= 0;
+        if (ok && (n != (ssize_t)sizeof(header) || !arena_file_header_valid(&header, st.st_size))) {
+            errno = EINVAL;
+            ok = 0;
+        }
+        if (ok) {
+            base = anywhere ? NULL : header.base;
+            size_bytes = header.size;
+        }
+    }
+
+    void *p = MAP_FAILED;
+    if (ok) {
+        int flags = MAP_SHARED;
+#ifdef MAP_FIXED_NOREPLACE
+        if (base != NULL) flags |= MAP_FIXED_NOREPLACE;
+#endif // MAP_FIXED_NOREPLACE
+        p = mmap(base, size_bytes, PROT_READ | PROT_WRITE, flags, fd, 0);
+        // Kernels without MAP_FIXED_NOREPLACE take the address as a hint
+        if (p != MAP_FAILED && base != NULL && p != base) {
+            munmap(p, size_bytes);
+            p = MAP_FAILED;
+            errno = EEXIST;
+        }
+    }
+
+    if (p != MAP_FAILED && !fresh && !arena_file_region_valid((Region*)((char*)p + ARENA_FILE_HEADER_SIZE), size_bytes)) {
+        munmap(p, size_bytes);
+        p = MAP_FAILED;
+        errno = EINVAL;
+    }
+    if (p == MAP_FAILED) {
+        // Otherwise the next attempt would find a non-empty file without a header and reject it
+        if (fresh) {
+            int saved_errno = errno;
+            int ret = ftruncate(fd, 0);
+            (void) ret;
+            errno = saved_errno;
+        }
+        return 0;
+    }
+
+    Arena_File_Header *h = (Arena_File_Header*)p;
+    Region *r = (Region*)((char*)p + ARENA_FILE_HEADER_SIZE);
+    if (fresh) {
+        r->next = NULL;
+        r->count = 0;
+        r->capacity = (size_bytes - ARENA_FILE_HEADER_SIZE - sizeof(Region))/sizeof(uintptr_t);
+        r->flags = ARENA_REGION_BORROWED;
+        h->version = ARENA_FILE_VERSION;
+        h->word_size = sizeof(uintptr_t);
+        h->base = p;
+        h->size = size_bytes;
+        h->root = NULL;
+        // The magic goes last, so a file that wasn't initialized completely is rejected
+        arena_memcpy(h->magic, arena_file_magic, sizeof(arena_file_magic));
+    } else {
+        // Only ever the arena of the file, never given back to a backend
+        r->flags = ARENA_REGION_BORROWED;
+    }
+
+    Arena arena = {0};
+    f->arena = arena;
+    f->arena.begin = r;
+    f->arena.end = r;
+    f->arena.fixed = 1;
+    f->header = h;
+    f->fd = fd;
+    return 1;
+}
+
+int arena_file_sync(Arena_File *f, int async)
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t used = ARENA_FILE_HEADER_SIZE + sizeof(Region) + sizeof(uintptr_t)*f->arena.begin->count;
+    used = (used + page_size - 1)/page_size*page_size;
+    if (used > f->header->size) used = f->header->size;
+    return msync(f->header, used, async ? MS_ASYNC : MS_SYNC) == 0;
+}
+
+int arena_file_create_shared(Arena_File *f, const char *name, size_t size_bytes, void *base)
+{
+#ifdef __linux__
+    int fd = (int)syscall(SYS_memfd_create, name, 0);
+#else
+    // Unlinked right away, the descriptor keeps the memory alive
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) shm_unlink(name);
+#endif // __linux__
+    if (fd < 0) return 0;
+    if (!arena_file_open_fd(f, fd, size_bytes, base)) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return 0;
+    }
+    return 1;
+}
+
+void arena_file_close(Arena_File *f)
+{
+    munmap(f->header, f->header->size);
+    close(f->fd);
+    f->arena.begin = NULL;
+    f->arena.end = NULL;
+    f->header = NULL;
+    f->fd = -1;
 }
+#endif // ARENA_FILE
 
 #endif // ARENA_IMPLEMENTATION
@@ -0,0 +1 @@
+../../arena.h
\ No newline at end of file
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#define ARENA_SHARED
+#define ARENA_IMPLEMENTATION
+#include "arena.h"
+
+#define ALLOCS_PER_THREAD (1000*1000)
+#define ALLOC_SIZE 32
+
+// The baseline: what you have to do to share a regular Arena between threads
+static Arena locked_arena = {0};
+static pthread_mutex_t locked_arena_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static Arena_Shared shared_arena = ARENA_SHARED_INIT;
+
+static void *locked_worker(void *arg)
+{
+    (void) arg;
+    for (size_t i = 0; i < ALLOCS_PER_THREAD; ++i) {
+        pthread_mutex_lock(&locked_arena_lock);
+        char *p = arena_alloc(&locked_arena, ALLOC_SIZE);
+        pthread_mutex_unlock(&locked_arena_lock);
+        p[0] = (char)i;
+    }
+    return NULL;
+}
+
+static void *shared_worker(void *arg)
+{
+    (void) arg;
+    for (size_t i = 0; i < ALLOCS_PER_THREAD; ++i) {
+        char *p = arena_shared_alloc(&shared_arena, ALLOC_SIZE);
+        p[0] = (char)i;
+    }
+    return NULL;
+}
+
+static double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static double run(void *(*worker)(void*), size_t threads_count)
+{
+    pthread_t threads[256];
+    double begin = now_secs();
+    for (size_t i = 0; i < threads_count; ++i) pthread_create(&threads[i], NULL, worker, NULL);
+    for (size_t i = 0; i < threads_count; ++i) pthread_join(threads[i], NULL);
+    return now_secs() - begin;
+}
+
+int main(int argc, char **argv)
+{
+    long max_threads = argc > 1 ? atol(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_threads < 1) max_threads = 1;
+    if (max_threads > 256) max_threads = 256;
+
+    printf("%7s  %18s  %18s\n", "threads", "mutex (Mallocs/s)", "shared (Mallocs/s)");
+    // 1, 2, 3, 4, 8, 16, ... and max_threads itself
+    for (long n = 1; n <= max_threads;) {
+        double locked_secs = run(locked_worker, n);
+        arena_free(&locked_arena);
+        double shared_secs = run(shared_worker, n);
+        arena_shared_free(&shared_arena);
+        double total = (double)n*ALLOCS_PER_THREAD/1e6;
+        printf("%7ld  %18.1f  %18.1f\n", n, total/locked_secs, total/shared_secs);
+
+        if (n == max_threads) break;
+        n = n < 4 ? n + 1 : n*2;
+        if (n > max_threads) n = max_threads;
+    }
+
+    return 0;
+}
@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <string.h>
+#define ARENA_IMPLEMENTATION
+#include "arena.h"
+
+#define STRINGS_COUNT 200000
+
+int main(void)
+{
+    Arena a = {0};
+    Arena_Intern_Table table = {0};
+    char buf[64];
+
+    // Enough distinct strings for the table to outgrow its region a few times. With
+    // ARENA_MREMAP_MAYMOVE the region gets moved by the kernel when the table is the only thing
+    // in it, and the strings must not end up in the place it was moved away from.
+    for (size_t i = 0; i < STRINGS_COUNT; ++i) {
+        int n = snprintf(buf, sizeof(buf), "identifier_%zu", i);
+        const char *s = arena_intern(&a, &table, buf, (size_t)n);
+        if (s == NULL || strcmp(s, buf) != 0) {
+            fprintf(stderr, "ERROR: could not intern %s\n", buf);
+            return 1;
+        }
+    }
+
+    // Interning the same strings again gives back the same pointers
+    for (size_t i = 0; i < STRINGS_COUNT; i += 1000) {
+        int n = snprintf(buf, sizeof(buf), "identifier_%zu", i);
+        const char *s1 = arena_intern(&a, &table, buf, (size_t)n);
+        const char *s2 = arena_intern_cstr(&a, &table, buf);
+        if (s1 != s2 || strcmp(s1, buf) != 0) {
+            fprintf(stderr, "ERROR: %s was interned twice\n", buf);
+            return 1;
+        }
+    }
+
+    size_t used = 0;
+    for (Region *r = a.begin; r != NULL; r = r->next) used += sizeof(uintptr_t)*r->count;
+    printf("ok %zu strings, %zu bytes of the arena used\n", table.count, used);
+
+    arena_free(&a);
+    return 0;
+}
@@ -0,0 +1,2 @@
+#define ARENA_IMPLEMENTATION
+#include "arena.h"
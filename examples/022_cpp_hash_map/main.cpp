@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <string.h>
+#include "arena.h"
+
+static const char *text =
+    "the quick brown fox jumps over the lazy dog "
+    "the dog barks and the fox runs over the hill "
+    "a fox is quick and a dog is lazy";
+
+int main()
+{
+    Arena a = {};
+    Arena_Intern_Table words = {};
+    // Interned strings are equal only if they are the same pointer, so they make good keys
+    Arena_Hash_Map<const char*, size_t> counts;
+
+    const char *word = text;
+    while (*word != '\0') {
+        size_t len = strcspn(word, " ");
+        const char *key = arena_intern(&a, &words, word, len);
+        size_t *count = key ? counts.put(&a, key) : nullptr;
+        if (count == nullptr) {
+            fprintf(stderr, "ERROR: out of memory\n");
+            return 1;
+        }
+        *count += 1;
+        word += len;
+        word += strspn(word, " ");
+    }
+
+    // Look the words up again, spelled with a different buffer
+    const char *lookup[] = {"the", "fox", "dog", "cat"};
+    for (size_t i = 0; i < sizeof(lookup)/sizeof(lookup[0]); ++i) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%s", lookup[i]);
+        size_t *count = counts.get(arena_intern_cstr(&a, &words, buf));
+        printf("%s: %zu\n", lookup[i], count ? *count : 0);
+    }
+    printf("%zu distinct words\n", counts.count);
+
+    arena_free(&a);
+    return 0;
+}
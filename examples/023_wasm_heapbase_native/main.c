@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdint.h>
+
+// A simulated WebAssembly linear memory: a static buffer that starts with a single 64KiB page and
+// can grow up to MEMORY_MAX_PAGES, just like memory.grow would. The first kilobyte stands in for
+// the data and the stack that come before __heap_base.
+#define MEMORY_PAGE_SIZE (64*1024)
+#define MEMORY_MAX_PAGES 16
+static _Alignas(16) unsigned char memory[MEMORY_MAX_PAGES*MEMORY_PAGE_SIZE];
+static size_t memory_pages = 1;
+
+static long memory_grow(size_t delta_pages)
+{
+    if (memory_pages + delta_pages > MEMORY_MAX_PAGES) return -1;
+    long previous = (long)memory_pages;
+    memory_pages += delta_pages;
+    return previous;
+}
+
+#define ARENA_BACKEND ARENA_BACKEND_WASM_HEAPBASE
+#define ARENA_WASM_HEAP_BASE (memory + 1024)
+#define ARENA_WASM_MEMORY_BASE ((uintptr_t)memory)
+#define ARENA_WASM_MEMORY_SIZE() memory_pages
+#define ARENA_WASM_MEMORY_GROW(delta_pages) memory_grow(delta_pages)
+#define ARENA_IMPLEMENTATION
+#include "arena.h"
+
+static size_t heap_used(void)
+{
+    return (size_t)(bump_pointer - ARENA_WASM_HEAP_BASE);
+}
+
+int main(void)
+{
+    Arena a = {0};
+
+    // Allocations bump regions carved out of the buffer, growing the memory page by page
+    char *first = arena_sprintf(&a, "string number %d", 0);
+    printf("\"%s\" at offset %zu of the memory\n", first, (size_t)((unsigned char*)first - memory));
+    for (int i = 1; i < 1000; ++i) arena_sprintf(&a, "string number %d", i);
+    printf("after 1000 strings: %zu bytes of heap in %zu pages\n", heap_used(), memory_pages);
+
+    int *numbers = arena_alloc(&a, 100000*sizeof(int));
+    for (int i = 0; i < 100000; ++i) numbers[i] = i;
+    printf("after a big array:  %zu bytes of heap in %zu pages\n", heap_used(), memory_pages);
+
+    // The linear memory never shrinks, freed regions are kept and handed out to the next arenas
+    arena_free(&a);
+    Arena b = {0};
+    arena_alloc(&b, 100000*sizeof(int));
+    printf("after freeing and allocating the array again: %zu bytes of heap in %zu pages\n", heap_used(), memory_pages);
+    arena_free(&b);
+
+    // Or throw away everything at once and start over from the heap base
+    arena_wasm_heapbase_reset();
+    printf("after arena_wasm_heapbase_reset(): %zu bytes of heap in %zu pages\n", heap_used(), memory_pages);
+    return 0;
+}
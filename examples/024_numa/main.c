@@ -0,0 +1,33 @@
+#include <stdio.h>
+#include <string.h>
+#define ARENA_NUMA
+#define ARENA_IMPLEMENTATION
+#include "arena.h"
+
+#define REGIONS_COUNT 4
+
+static void fill_and_report(const char *name, int policy, int node)
+{
+    Arena a = {0};
+    arena_set_numa_policy(&a, policy, node);
+
+    // One default sized region per allocation, touched so the pages actually get placed
+    size_t size_bytes = sizeof(uintptr_t)*ARENA_REGION_DEFAULT_CAPACITY;
+    for (int i = 0; i < REGIONS_COUNT; ++i) memset(arena_alloc(&a, size_bytes), 0xAA, size_bytes);
+
+    printf("%-10s regions on nodes:", name);
+    for (Region *r = a.begin; r != NULL; r = r->next) printf(" %d", arena_region_numa_node(r));
+    printf("\n");
+    arena_free(&a);
+}
+
+int main(void)
+{
+    // On a machine with a single node (or a kernel without NUMA support) every policy does
+    // nothing and all the regions end up on node 0, or -1 if the node can't be determined
+    fill_and_report("default", ARENA_NUMA_DEFAULT, 0);
+    fill_and_report("local", ARENA_NUMA_LOCAL, 0);
+    fill_and_report("preferred", ARENA_NUMA_PREFERRED, 1);
+    fill_and_report("interleave", ARENA_NUMA_INTERLEAVE, 0);
+    return 0;
+}